@@ -2,7 +2,6 @@
 #define VARF_ARCHIVE_HEADER
 
 /**
- * ZIP64 not supported right now
  * Encryption not supported right now
  * File attributes not supported right now
  *
@@ -10,20 +9,164 @@
  * should be a fun exercise to figure that out
  */
 
+#include <chrono>
 #include <cstdint>
+#include <filesystem>
 #include <istream>
+#include <memory>
+#include <optional>
 #include <ostream>
+#include <span>
 #include <string>
+#include <string_view>
+#include <variant>
 #include <vector>
 
 namespace varf {
 
+namespace archive_mode {
+
+/**
+ * @brief the whole archive is read into memory on construction
+ */
+constexpr uint8_t eager = 0x00;
+/**
+ * @brief only the directory is read on construction,
+ *        entry data is read from the source when it is requested
+ *        the source must outlive the archive
+ */
+constexpr uint8_t lazy = 0x01;
+/**
+ * @brief implies lazy, the source is also written to when the archive is committed
+ *        only entries added since the last commit and the directory are appended
+ */
+constexpr uint8_t update = 0x02 | lazy;
+
+} // namespace archive_mode
+
+using ArchiveMode = uint8_t;
+
+namespace archive_compression {
+
+/**
+ * @brief data is stored as is
+ */
+constexpr uint8_t none = 0x00;
+/**
+ * @brief data is a raw deflate stream
+ */
+constexpr uint8_t deflate = 0x08;
+
+} // namespace archive_compression
+
+using ArchiveCompression = uint8_t;
+
+/**
+ * @brief Describes an entry of an archive, it can be used as a handle to it
+ *        handles stay valid when other entries are removed, using one after its entry was removed throws
+ */
 struct ArchiveEntry
 {
     const std::string file_name;
     const size_t index;
-    const uint32_t uncompressed_size;
-    const uint32_t compressed_size;
+    const uint32_t generation;
+    const uint64_t uncompressed_size;
+    const uint64_t compressed_size;
+};
+
+/**
+ * @brief Data to be added to an archive, either from a stream or from memory
+ *        the data has to stay alive until it has been pushed
+ */
+struct ArchiveInput
+{
+    std::string_view name;
+    std::variant<std::istream*, std::span<const uint8_t>> data;
+};
+
+/**
+ * @brief Decides how each pushed entry is compressed
+ *        deflating data that does not compress, like images or audio, is wasted work
+ *        so it can be stored directly depending on its extension or on its estimated entropy
+ */
+struct CompressionPolicy
+{
+    /**
+     * @brief archive_compression::none stores every entry
+     */
+    ArchiveCompression compression{archive_compression::deflate};
+    /**
+     * @brief deflate level, from 1 for fastest to 9 for smallest
+     */
+    int level{6};
+    /**
+     * @brief entries with these extensions are always stored, case insensitive
+     */
+    std::vector<std::string> stored_extensions{
+        ".png", ".jpg", ".jpeg", ".webp", ".ogg", ".mp3", ".mp4", ".webm",
+        ".zip", ".gz", ".xz", ".bz2", ".zst", ".7z", ".rar",
+    };
+    /**
+     * @brief entries with these extensions are always deflated, case insensitive
+     */
+    std::vector<std::string> deflated_extensions{};
+    /**
+     * @brief entries whose sampled byte entropy is above this, in bits per byte, are stored
+     *        8 or more disables the estimate
+     */
+    double max_entropy{7.5};
+};
+
+/**
+ * @brief Compressed data of an entry together with what is needed to decompress and verify it
+ *        used to move entries between archives without recompressing them
+ */
+struct RawArchiveEntry
+{
+    std::vector<uint8_t> compressed_data;
+    ArchiveCompression compression;
+    uint32_t crc;
+    uint64_t uncompressed_size;
+};
+
+/**
+ * @brief Options for Archive::ExtractAll
+ */
+struct ExtractOptions
+{
+    /**
+     * @brief number of threads used, 0 to use all available
+     */
+    unsigned int threads{0};
+    /**
+     * @brief replace files that already exist, otherwise they are skipped
+     */
+    bool overwrite{true};
+};
+
+/**
+ * @brief What was done by Archive::ExtractAll
+ */
+struct ExtractStats
+{
+    size_t files{0};
+    size_t directories{0};
+    size_t skipped{0};
+    uint64_t uncompressed_bytes{0};
+    uint64_t compressed_bytes{0};
+    std::chrono::nanoseconds elapsed{0};
+
+    /**
+     * @brief Obtains the extraction speed
+     *
+     * @return double uncompressed bytes written per second
+     */
+    [[nodiscard]]
+    double GetThroughput() const
+    {
+        const auto seconds = std::chrono::duration<double>(elapsed).count();
+        return seconds > 0 ? static_cast<double>(uncompressed_bytes) / seconds : 0.0;
+    }
 };
 
 class Archive
@@ -48,11 +191,65 @@ public:
      */
     virtual void Push(const std::string_view name, std::istream& stream) = 0;
 
+    /**
+     * @brief Adds many files to the archive compressing them in parallel
+     *        entries are added in the same order as the inputs, so the result
+     *        does not depend on the number of threads
+     *
+     * @param inputs the names and data of the files to be added, streams must be different objects
+     * @param threads number of threads used, 0 to use all available
+     * @throws std::runtime_error if any entry was not created, then no entry is added
+     */
+    virtual void PushMany(std::span<const ArchiveInput> inputs, unsigned int threads = 0) = 0;
+
+    /**
+     * @brief Sets how the entries pushed afterwards are compressed, it is applied to each entry
+     *        entries that do not get smaller when deflated are always stored
+     *
+     * @param policy the compression policy
+     */
+    virtual void SetCompressionPolicy(CompressionPolicy policy) = 0;
+
+    /**
+     * @brief Adds already compressed data to the archive as a file, it is not recompressed
+     *
+     * @param name the name of the file
+     * @param entry the compressed data and its metadata, usually obtained with PeekRaw
+     * @throws std::runtime_error if the compression is unknown or the sizes of stored data do not match
+     */
+    virtual void PushRaw(const std::string_view name, RawArchiveEntry entry) = 0;
+
+    /**
+     * @brief Copies an entry from another archive without decompressing it
+     *
+     * @param other the archive containing the entry
+     * @param entry the entry to be copied
+     */
+    void CopyEntryFrom(const Archive& other, const ArchiveEntry& entry)
+    {
+        PushRaw(entry.file_name, other.PeekRaw(entry));
+    }
+
+    /**
+     * @brief Writes every entry to a directory, entries are decompressed and written in parallel
+     *        the directories are created once before any file is written
+     *        entry names are used as paths relative to destination
+     *
+     * @param destination the directory the entries are extracted to, it is created if needed
+     * @param options number of threads and what to do with existing files
+     * @return ExtractStats what was written and how long it took
+     * @throws std::runtime_error if an entry is corrupted, can not be written
+     *         or its name is absolute or escapes destination
+     */
+    ExtractStats ExtractAll(const std::filesystem::path& destination, const ExtractOptions& options = {}) const;
+
     /**
      * @brief Removes data from the archive in the form of decompressed data
+     *        removal takes constant time and handles to other entries stay valid
      *
      * @param entry the entry to be popped
      * @return std::vector<uint8_t> Containing the data
+     * @throws std::runtime_error if the entry is not in the archive
      */
     virtual std::vector<uint8_t> Pop(const ArchiveEntry& entry) = 0;
 
@@ -61,10 +258,85 @@ public:
      *
      * @param entry the entry to be peeked
      * @return std::vector<uint8_t> Containing the data
+     * @throws std::runtime_error if the entry is not in the archive
      */
     [[nodiscard]]
     virtual std::vector<uint8_t> Peek(const ArchiveEntry& entry) const = 0;
 
+    /**
+     * @brief Decompresses an entry straight into memory owned by the caller, nothing is allocated for the data
+     *
+     * @param entry the entry to be peeked
+     * @param output where the data is written, it must hold at least entry.uncompressed_size bytes
+     * @return std::span<uint8_t> the part of output containing the data
+     * @throws std::runtime_error if the entry is not in the archive, output is too small or the data is corrupted
+     */
+    virtual std::span<uint8_t> Peek(const ArchiveEntry& entry, std::span<uint8_t> output) const = 0;
+
+    /**
+     * @brief Decompresses an entry into a buffer that is reused between calls
+     *        the buffer only grows, so peeking many entries into the same one stops allocating
+     *
+     * @param entry the entry to be peeked
+     * @param buffer grown to entry.uncompressed_size if it is smaller, it is never shrunk
+     * @return std::span<uint8_t> the part of buffer containing the data
+     * @throws std::runtime_error if the entry is not in the archive or the data is corrupted
+     */
+    std::span<uint8_t> Peek(const ArchiveEntry& entry, std::vector<uint8_t>& buffer) const
+    {
+        if (buffer.size() < entry.uncompressed_size)
+        {
+            buffer.resize(entry.uncompressed_size);
+        }
+        return Peek(entry, std::span<uint8_t>(buffer));
+    }
+
+    /**
+     * @brief Obtains the data of an entry without copying it when possible
+     *        stored entries held in memory are viewed where the archive keeps them,
+     *        other entries are decompressed or read into scratch, which only grows
+     *
+     * @param entry the entry to be viewed
+     * @param scratch buffer used when the data can not be viewed in place, it can be reused between calls
+     * @return std::span<const uint8_t> the data, valid until the entry is removed, the archive destroyed
+     *         or scratch is modified
+     * @throws std::runtime_error if the entry is not in the archive or the data is corrupted
+     */
+    [[nodiscard]]
+    virtual std::span<const uint8_t> View(const ArchiveEntry& entry, std::vector<uint8_t>& scratch) const = 0;
+
+    /**
+     * @brief Obtains the compressed data of an entry without decompressing it
+     *
+     * @param entry the entry to be peeked
+     * @return RawArchiveEntry the compressed data and its metadata
+     * @throws std::runtime_error if the entry is not in the archive
+     */
+    [[nodiscard]]
+    virtual RawArchiveEntry PeekRaw(const ArchiveEntry& entry) const = 0;
+
+    /**
+     * @brief Opens a forward only stream that decompresses the entry as it is read
+     *        memory usage is bounded by the decompression window instead of the entry size
+     *        the stream is invalidated if the entry is popped or the archive destroyed
+     *
+     * @param entry the entry to be opened
+     * @return std::unique_ptr<std::istream> stream to the decompressed data
+     * @throws std::runtime_error if the entry is not in the archive
+     */
+    [[nodiscard]]
+    virtual std::unique_ptr<std::istream> Open(const ArchiveEntry& entry) const = 0;
+
+    /**
+     * @brief Finds an entry by name in constant time, the lookup itself does not allocate
+     *        if several entries share a name the last one added is found
+     *
+     * @param name the name of the file
+     * @return std::optional<ArchiveEntry> the entry, or std::nullopt if there is none with that name
+     */
+    [[nodiscard]]
+    virtual std::optional<ArchiveEntry> Find(const std::string_view name) const = 0;
+
     /**
      * @brief Obtains a vector containing a recollection of the archive contents
      *
@@ -11,8 +11,10 @@
  */
 
 #include <cstdint>
+#include <filesystem>
 #include <istream>
 #include <ostream>
+#include <span>
 #include <vector>
 
 #include <varf/Archive.hpp>
@@ -45,6 +47,8 @@ namespace varf {
  *         │  ║ central directory header 2      ║───┘│
  *         │  ╟───────────────///───────────────╢    │
  *         │  ║ central directory header n      ║────┘
+ *         │  ╟─────────────────────────────────╢
+ *         │  ║ extension records, optional     ║
  *         │  ╠═════════════════════════════════╣
  *         └──║ end of central directory record ║
  *            ╚═════════════════════════════════╝
@@ -66,9 +70,30 @@ namespace varf {
  *            ║      │ comp method                             ║
  *            ║  1B  │┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄║
  *            ║      │     8 for DEFLATE (-MAX_WBITS)          ║
+ *            ║      │     0x88 for chunked DEFLATE            ║
+ *            ║      │     0x48 for DEFLATE with the dictionary║
  *            ║      │     0 for none                          ║
  *            ╚══════╧═════════════════════════════════════════╝
  *
+ *            local file headers are found through the central directory, so there can be padding
+ *            before them, it is used to align the data of stored entries
+ *
+ *            chunked DEFLATE data starts with a chunk table, followed by the chunks
+ *            each chunk is deflated on its own, so it can be inflated without the ones before it
+ *            and all of them together form a single DEFLATE stream
+ *            ╔═ chunk table ══════════════════════════════════╗
+ *            ║ size │ name                                    ║
+ *            ╠══════╪═════════════════════════════════════════╣
+ *            ║  4B  │ uncompressed size of each chunk         ║
+ *            ║      │     the last one can be smaller         ║
+ *            ╟──────┼─────────────────────────────────────────╢
+ *            ║  4B  ┢ chunk count                             ║
+ *            ╟──────╂─────────────────────────────────────────╢
+ *            ║      │ end of each chunk                       ║
+ *            ║ n*8B<┩┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄║
+ *            ║      │     from the end of the table           ║
+ *            ╚══════╧═════════════════════════════════════════╝
+ *
  *            ╔═ central directory header ═════════════════════╗
  *            ║ size │ name                                    ║
  *            ╠══════╪═════════════════════════════════════════╣
@@ -85,6 +110,71 @@ namespace varf {
  *            ║  nB <┩ file name                               ║
  *            ╚══════╧═════════════════════════════════════════╝
  *
+ *            entries in a solid block share a local file header, its data is the entries one after another
+ *            compressed together, the header of each entry says where it is in the block
+ *            ╔═ solid central directory header ═══════════════╗
+ *            ║ size │ name                                    ║
+ *            ╠══════╪═════════════════════════════════════════╣
+ *            ║      │ signature                               ║
+ *            ║  4B  │┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄║
+ *            ║      │     always 0x0203564C                   ║
+ *            ╟──────┼─────────────────────────────────────────╢
+ *            ║  8B  │ offset to the block local file header   ║
+ *            ╟──────┼─────────────────────────────────────────╢
+ *            ║  8B  │ offset in the uncompressed block        ║
+ *            ╟──────┼─────────────────────────────────────────╢
+ *            ║  8B  │ uncompressed size                       ║
+ *            ╟──────┼─────────────────────────────────────────╢
+ *            ║  4B  │ crc32 of uncompressed data              ║
+ *            ╟──────┼─────────────────────────────────────────╢
+ *            ║  4B  ┢ file name length                        ║
+ *            ╟──────╂─────────────────────────────────────────╢
+ *            ║  nB <┩ file name                               ║
+ *            ╚══════╧═════════════════════════════════════════╝
+ *
+ *            ╔═ extension record ═════════════════════════════╗
+ *            ║ size │ name                                    ║
+ *            ╠══════╪═════════════════════════════════════════╣
+ *            ║      │ signature                               ║
+ *            ║  4B  │┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄║
+ *            ║      │     always 0x0807564C                   ║
+ *            ╟──────┼─────────────────────────────────────────╢
+ *            ║      │ type, unknown types are skipped         ║
+ *            ║  4B  │┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄║
+ *            ║      │     1 for the preset dictionary         ║
+ *            ║      │     2 for the name index                ║
+ *            ╟──────┼─────────────────────────────────────────╢
+ *            ║  8B  ┢ data size                               ║
+ *            ╟──────╂─────────────────────────────────────────╢
+ *            ║  nB <┩ data                                    ║
+ *            ╚══════╧═════════════════════════════════════════╝
+ *
+ *            the name index numbers entries in central directory order
+ *            names are hashed with 64 bit FNV-1a, linear probing starts at hash & (slot count - 1)
+ *            it is the last extension record, so its last 8 bytes are the last ones of the central directory
+ *            ╔═ name index ═══════════════════════════════════╗
+ *            ║ size │ name                                    ║
+ *            ╠══════╪═════════════════════════════════════════╣
+ *            ║  4B  ┢ slot count, a power of two              ║
+ *            ╟──────╂─────────────────────────────────────────╢
+ *            ║  4B  ┃ entry count                             ║
+ *            ╟──────╂─────────────────────────────────────────╢
+ *            ║      ┃ slots                                   ║
+ *            ║ n*8B<┩┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄║
+ *            ║      │     4B upper half of the hash           ║
+ *            ║      │     4B entry number + 1, 0 if empty     ║
+ *            ╟──────┼─────────────────────────────────────────╢
+ *            ║ n*4B │ entry numbers sorted by name            ║
+ *            ╟──────┼─────────────────────────────────────────╢
+ *            ║      │ offset to each central directory header ║
+ *            ║ n*8B │┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄║
+ *            ║      │     from the start of central directory ║
+ *            ╟──────┼─────────────────────────────────────────╢
+ *            ║      │ offset to the first extension record    ║
+ *            ║  8B  │┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄┄║
+ *            ║      │     from the start of central directory ║
+ *            ╚══════╧═════════════════════════════════════════╝
+ *
  *            ╔═ end of central directory record ══════════════╗
  *            ║ size │ name                                    ║
  *            ╠══════╪═════════════════════════════════════════╣
@@ -103,22 +193,70 @@ namespace varf {
 class RezipArchive : public Archive
 {
 public:
+    /**
+     * @brief deflate can not reference data further back than its 32 KiB window
+     */
+    static constexpr size_t MAX_DICTIONARY_SIZE = 0x8000;
+
     RezipArchive();
     /**
      * @brief Constructs an archive from a stream
      *
      * @param stream stream to archive data
+     * @param mode archive_mode::eager to read every entry on construction
+     *             archive_mode::lazy to only read the directory and the entry headers, entries
+     *             are read from the stream when they are needed so it must outlive the archive
+     * @throws std::runtime_error if the data is not a Rezip archive or mode is archive_mode::update
+     */
+    RezipArchive(std::istream& stream, ArchiveMode mode = archive_mode::eager);
+    /**
+     * @brief Constructs an archive from memory, like resources embedded in the executable
+     *        only the directory and the entry headers are read, entries are decompressed
+     *        straight from the memory so nothing is copied until they are needed
+     *        with a name index not even the headers are read, see SetNameIndex
+     *
+     * @param data the archive, it must not change and must outlive the archive
+     * @throws std::runtime_error if the data is not a Rezip archive
+     */
+    explicit RezipArchive(std::span<const uint8_t> data);
+    /**
+     * @brief Constructs an archive from a file on disk by mapping it into memory
+     *        entries are decompressed straight from the mapped pages, so the page cache
+     *        is the only copy of the compressed data and it is shared with other processes
+     *        the file must not be modified while the archive exists
+     *
+     * @param path path to the Rezip file
+     * @throws std::runtime_error if the file can not be mapped or is not a Rezip archive
      */
-    RezipArchive(std::istream& stream);
+    explicit RezipArchive(const std::filesystem::path& path);
     ~RezipArchive() override;
 
+    /**
+     * @brief What was saved by writing identical entries once
+     */
+    struct DeduplicationStats
+    {
+        size_t deduplicated_entries{0};
+        uint64_t saved_bytes{0};
+    };
+
     /**
      * @brief Creates a Rezip file from the archive
+     *        entries with identical compressed data are written once
+     *        and every name pointing to them shares that copy
      *
      * @param stream a stream to the file to be saved
      */
     void Write(std::ostream& stream) const override;
 
+    /**
+     * @brief Creates a Rezip file from the archive, reporting what deduplication saved
+     *
+     * @param stream a stream to the file to be saved
+     * @param stats receives the number of entries that were not written again and the bytes saved
+     */
+    void Write(std::ostream& stream, DeduplicationStats& stats) const;
+
     /**
      * @brief Adds data to the archive as a file
      *
@@ -128,6 +266,91 @@ public:
      */
     void Push(const std::string_view name, std::istream& stream) override;
 
+    /**
+     * @brief Adds many files to the archive compressing them in parallel
+     *
+     * @param inputs the names and data of the files to be added
+     * @param threads number of threads used, 0 to use all available
+     * @throws std::runtime_error if any entry was not created, then no entry is added
+     */
+    void PushMany(std::span<const ArchiveInput> inputs, unsigned int threads = 0) override;
+
+    /**
+     * @brief Sets how the entries pushed afterwards are compressed
+     *
+     * @param policy the compression policy
+     */
+    void SetCompressionPolicy(CompressionPolicy policy) override;
+
+    /**
+     * @brief Splits deflated entries pushed afterwards in chunks that are compressed independently
+     *        chunked entries can be read from any offset with PeekRange, which only inflates the chunks it needs,
+     *        at the cost of a slightly worse compression ratio
+     *
+     * @param chunk_size uncompressed size of each chunk, 0 to not chunk entries, which is the default
+     */
+    void SetChunkSize(uint32_t chunk_size);
+
+    /**
+     * @brief Sets a preset dictionary for the deflated entries pushed afterwards, it is stored once in the archive
+     *        small entries that share content with the dictionary compress better and inflate faster,
+     *        chunked entries do not use it
+     *
+     * @param dictionary the dictionary, only its last MAX_DICTIONARY_SIZE bytes are used, empty to not use one
+     * @throws std::runtime_error if entries of the archive use a different dictionary
+     */
+    void SetDictionary(std::span<const uint8_t> dictionary);
+
+    /**
+     * @brief Makes Write pack small deflated entries together in solid blocks compressed as a whole
+     *        many small similar entries compress much better this way, but reading one inflates the whole block,
+     *        the last block inflated is kept so reading the entries of a block in order inflates it once
+     *        stored and chunked entries are always written on their own
+     *
+     * @param block_size uncompressed size of each block, entries of this size or bigger are not packed,
+     *                   0 to write every entry on its own, which is the default
+     */
+    void SetSolidBlockSize(uint32_t block_size);
+
+    /**
+     * @brief Makes Write pad the archive so the data of stored entries starts at a multiple of alignment
+     *        from the beginning of the file, so a mapped archive can hand out page or SIMD aligned data
+     *        the padding goes before the local file header and is at most alignment - 1 bytes per stored entry
+     *
+     * @param alignment the boundary, for example 4096 for pages or 64 for cache lines,
+     *                  0 to not pad, which is the default
+     */
+    void SetStoredAlignment(uint32_t alignment);
+
+    /**
+     * @brief Makes Write add a name index to the central directory, a hash table and a table of sorted names
+     *        archives read with an index do not build one in memory, Find and FindPrefix use the one
+     *        that was read until entries are added or removed
+     *        archives read lazily with an index do not parse the central directory on construction,
+     *        each entry is parsed when it is first used
+     *
+     * @param write_name_index true to write the index, it is not written by default
+     */
+    void SetNameIndex(bool write_name_index);
+
+    /**
+     * @brief Builds a dictionary from content common to several samples
+     *
+     * @param samples the data of some of the entries that will be pushed
+     * @param size maximum size of the dictionary
+     * @return std::vector<uint8_t> the dictionary, to be given to SetDictionary
+     */
+    static std::vector<uint8_t> TrainDictionary(std::span<const std::span<const uint8_t>> samples, size_t size = MAX_DICTIONARY_SIZE);
+
+    /**
+     * @brief Adds already compressed data to the archive as a file, it is not recompressed
+     *
+     * @param name the name of the file
+     * @param entry the compressed data and its metadata
+     * @throws std::runtime_error if the compression is unknown or the sizes of stored data do not match
+     */
+    void PushRaw(const std::string_view name, RawArchiveEntry entry) override;
+
     /**
      * @brief Removes data from the archive in the form of decompressed data
      *
@@ -144,6 +367,71 @@ public:
      */
     std::vector<uint8_t> Peek(const ArchiveEntry& entry) const override;
 
+    /**
+     * @brief Decompresses an entry straight into memory owned by the caller
+     *
+     * @param entry the entry to be peeked
+     * @param output where the data is written, it must hold at least entry.uncompressed_size bytes
+     * @return std::span<uint8_t> the part of output containing the data
+     */
+    std::span<uint8_t> Peek(const ArchiveEntry& entry, std::span<uint8_t> output) const override;
+
+    using Archive::Peek;
+
+    /**
+     * @brief Decompresses part of an entry, the crc is not verified as not all the data is read
+     *        only the chunks overlapping the range are decompressed for chunked entries,
+     *        other deflated entries are decompressed from their start
+     *
+     * @param entry the entry to be peeked
+     * @param offset where the range starts in the decompressed data
+     * @param output where the data is written, the range is as long as it, or until the end of the entry
+     * @return std::span<uint8_t> the part of output containing the data
+     * @throws std::runtime_error if the entry is not in the archive, offset is past its end or the data is corrupted
+     */
+    std::span<uint8_t> PeekRange(const ArchiveEntry& entry, uint64_t offset, std::span<uint8_t> output) const;
+
+    /**
+     * @brief Obtains the data of an entry without copying it when it is stored and held in memory
+     *
+     * @param entry the entry to be viewed
+     * @param scratch buffer used when the data can not be viewed in place
+     * @return std::span<const uint8_t> the data
+     */
+    std::span<const uint8_t> View(const ArchiveEntry& entry, std::vector<uint8_t>& scratch) const override;
+
+    /**
+     * @brief Obtains the compressed data of an entry without decompressing it
+     *
+     * @param entry the entry to be peeked
+     * @return RawArchiveEntry the compressed data and its metadata
+     */
+    RawArchiveEntry PeekRaw(const ArchiveEntry& entry) const override;
+
+    /**
+     * @brief Opens a forward only stream that decompresses the entry as it is read
+     *
+     * @param entry the entry to be opened
+     * @return std::unique_ptr<std::istream> stream to the decompressed data
+     */
+    std::unique_ptr<std::istream> Open(const ArchiveEntry& entry) const override;
+
+    /**
+     * @brief Finds an entry by name in constant time, the lookup itself does not allocate
+     *
+     * @param name the name of the file
+     * @return std::optional<ArchiveEntry> the entry, or std::nullopt if there is none with that name
+     */
+    std::optional<ArchiveEntry> Find(const std::string_view name) const override;
+
+    /**
+     * @brief Finds every entry whose name starts with a prefix, in logarithmic time if the archive was read with a name index
+     *
+     * @param prefix the start of the names, empty for every entry
+     * @return std::vector<ArchiveEntry> the entries sorted by name
+     */
+    std::vector<ArchiveEntry> FindPrefix(const std::string_view prefix) const;
+
     /**
      * @brief Obtains a vector containing a recollection of the archive contents
      *
@@ -152,7 +440,7 @@ public:
     std::vector<ArchiveEntry> GetDirectory() const override;
 
 private:
-    void read(std::istream& stream);
+    void read(std::istream& stream, ArchiveMode mode);
 
 private:
     struct Impl;
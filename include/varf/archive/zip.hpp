@@ -2,7 +2,6 @@
 #define VARF_ZIP_HEADER
 
 /**
- * ZIP64 not supported right now
  * Encryption not supported right now
  * File attributes not supported right now
  *
@@ -11,8 +10,11 @@
  */
 
 #include <cstdint>
+#include <filesystem>
 #include <istream>
 #include <ostream>
+#include <span>
+#include <string_view>
 #include <vector>
 
 #include <varf/Archive.hpp>
@@ -30,8 +32,29 @@ public:
      * @brief Constructs an archive from a stream
      *
      * @param stream stream to archive data
+     * @param mode archive_mode::eager to read every entry on construction
+     *             archive_mode::lazy to only read the central directory, entries
+     *             are read from the stream on Peek/Pop so it must outlive the archive
      */
-    ZipArchive(std::istream& stream);
+    ZipArchive(std::istream& stream, ArchiveMode mode = archive_mode::eager);
+    /**
+     * @brief Constructs an archive from a stream that can also be written
+     *
+     * @param stream stream to archive data
+     * @param mode same as with an istream, archive_mode::update allows calling Commit
+     *             to write changes in place, the stream must outlive the archive
+     */
+    ZipArchive(std::iostream& stream, ArchiveMode mode);
+    /**
+     * @brief Constructs an archive from a file on disk by mapping it into memory
+     *        entries are decompressed straight from the mapped pages, so the page cache
+     *        is the only copy of the compressed data and it is shared with other processes
+     *        the file must not be modified while the archive exists
+     *
+     * @param path path to the zip file
+     * @throws std::runtime_error if the file can not be mapped or is not a zip file
+     */
+    explicit ZipArchive(const std::filesystem::path& path);
     ~ZipArchive() override;
 
     /**
@@ -41,6 +64,20 @@ public:
      */
     void Write(std::ostream& stream) const override;
 
+    /**
+     * @brief Writes the changes to the stream the archive was opened with in archive_mode::update
+     *        entries added since the last commit and the new central directory are appended after the end
+     *        of the archive, so the cost depends on the changes and not on the size of the archive
+     *        the archive already in the stream is never overwritten, if the commit fails or is interrupted
+     *        truncating the stream to its previous size, for example with std::filesystem::resize_file, recovers it
+     *        each commit leaves the previous central directory and removed entries behind as unused space,
+     *        Write the archive to a new stream to reclaim it
+     *
+     * @return uint64_t size of the archive
+     * @throws std::runtime_error if the archive was not opened for update or could not be written
+     */
+    uint64_t Commit();
+
     /**
      * @brief Adds data to the archive as a file
      *
@@ -50,6 +87,31 @@ public:
      */
     void Push(const std::string_view name, std::istream& stream) override;
 
+    /**
+     * @brief Adds many files to the archive compressing them in parallel
+     *
+     * @param inputs the names and data of the files to be added
+     * @param threads number of threads used, 0 to use all available
+     * @throws std::runtime_error if any entry was not created, then no entry is added
+     */
+    void PushMany(std::span<const ArchiveInput> inputs, unsigned int threads = 0) override;
+
+    /**
+     * @brief Sets how the entries pushed afterwards are compressed
+     *
+     * @param policy the compression policy
+     */
+    void SetCompressionPolicy(CompressionPolicy policy) override;
+
+    /**
+     * @brief Adds already compressed data to the archive as a file, it is not recompressed
+     *
+     * @param name the name of the file
+     * @param entry the compressed data and its metadata
+     * @throws std::runtime_error if the compression is unknown or the sizes of stored data do not match
+     */
+    void PushRaw(const std::string_view name, RawArchiveEntry entry) override;
+
     /**
      * @brief Removes data from the archive in the form of decompressed data
      *
@@ -66,6 +128,50 @@ public:
      */
     std::vector<uint8_t> Peek(const ArchiveEntry& entry) const override;
 
+    /**
+     * @brief Decompresses an entry straight into memory owned by the caller
+     *
+     * @param entry the entry to be peeked
+     * @param output where the data is written, it must hold at least entry.uncompressed_size bytes
+     * @return std::span<uint8_t> the part of output containing the data
+     */
+    std::span<uint8_t> Peek(const ArchiveEntry& entry, std::span<uint8_t> output) const override;
+
+    using Archive::Peek;
+
+    /**
+     * @brief Obtains the data of an entry without copying it when it is stored and held in memory
+     *
+     * @param entry the entry to be viewed
+     * @param scratch buffer used when the data can not be viewed in place
+     * @return std::span<const uint8_t> the data
+     */
+    std::span<const uint8_t> View(const ArchiveEntry& entry, std::vector<uint8_t>& scratch) const override;
+
+    /**
+     * @brief Obtains the compressed data of an entry without decompressing it
+     *
+     * @param entry the entry to be peeked
+     * @return RawArchiveEntry the compressed data and its metadata
+     */
+    RawArchiveEntry PeekRaw(const ArchiveEntry& entry) const override;
+
+    /**
+     * @brief Opens a forward only stream that decompresses the entry as it is read
+     *
+     * @param entry the entry to be opened
+     * @return std::unique_ptr<std::istream> stream to the decompressed data
+     */
+    std::unique_ptr<std::istream> Open(const ArchiveEntry& entry) const override;
+
+    /**
+     * @brief Finds an entry by name in constant time, the lookup itself does not allocate
+     *
+     * @param name the name of the file
+     * @return std::optional<ArchiveEntry> the entry, or std::nullopt if there is none with that name
+     */
+    std::optional<ArchiveEntry> Find(const std::string_view name) const override;
+
     /**
      * @brief Obtains a vector containing a recollection of the archive contents
      *
@@ -74,7 +180,116 @@ public:
     std::vector<ArchiveEntry> GetDirectory() const override;
 
 private:
-    void read(std::istream& stream);
+    void read(std::istream& stream, ArchiveMode mode);
+
+private:
+    struct Impl;
+
+    Impl* p_impl;
+};
+
+/**
+ * @brief Writes a zip file directly to a stream as entries are added
+ *        only the central directory is kept in memory until Finish is called,
+ *        entries are compressed while read and followed by a data descriptor
+ *        so memory usage does not depend on the size of the archive
+ *
+ */
+class ZipWriter
+{
+public:
+    /**
+     * @brief Constructs a writer to a stream
+     *
+     * @param stream stream to the file to be written, it does not need to be seekable
+     */
+    ZipWriter(std::ostream& stream);
+    /**
+     * @brief Finishes the archive if Finish was not called
+     *
+     */
+    ~ZipWriter();
+
+    ZipWriter(const ZipWriter&) = delete;
+    ZipWriter& operator=(const ZipWriter&) = delete;
+    ZipWriter(ZipWriter&&) = delete;
+    ZipWriter& operator=(ZipWriter&&) = delete;
+
+    /**
+     * @brief Compresses data from a stream and writes it as a file in the archive
+     *
+     * @param name the name of the file
+     * @param stream a stream to the file to be added, read until eof
+     * @throws std::runtime_error if the archive was already finished
+     */
+    void Push(const std::string_view name, std::istream& stream);
+
+    /**
+     * @brief Compresses data and writes it as a file in the archive
+     *
+     * @param name the name of the file
+     * @param data the data of the file
+     * @throws std::runtime_error if the archive was already finished
+     */
+    void Push(const std::string_view name, std::span<const uint8_t> data);
+
+    /**
+     * @brief Writes the central directory, no more entries can be added afterwards
+     *
+     */
+    void Finish();
+
+private:
+    struct Impl;
+
+    Impl* p_impl;
+};
+
+/**
+ * @brief Reads a zip file front to back from a stream that does not need to seek, like a pipe
+ *        entries are found through their local file headers as they stream past,
+ *        the central directory is never read
+ *        stored entries followed by a data descriptor can not be read this way, as their size is unknown
+ *
+ */
+class ZipStreamReader
+{
+public:
+    /**
+     * @brief Constructs a reader from a stream
+     *
+     * @param stream stream to the zip data, it must outlive the reader
+     */
+    ZipStreamReader(std::istream& stream);
+    ~ZipStreamReader();
+
+    ZipStreamReader(const ZipStreamReader&) = delete;
+    ZipStreamReader& operator=(const ZipStreamReader&) = delete;
+    ZipStreamReader(ZipStreamReader&&) = delete;
+    ZipStreamReader& operator=(ZipStreamReader&&) = delete;
+
+    /**
+     * @brief Advances to the next entry, what was not read of the current one is skipped
+     *
+     * @return bool false once there are no more entries
+     * @throws std::runtime_error if the data is corrupted or ends unexpectedly
+     */
+    bool Next();
+
+    /**
+     * @brief Obtains the name of the current entry
+     *
+     * @return std::string_view the name, valid until Next is called
+     */
+    std::string_view GetName() const;
+
+    /**
+     * @brief Obtains a stream that decompresses the current entry as it is read
+     *        if the data is corrupted the stream sets its badbit
+     *
+     * @return std::istream& stream to the decompressed data, valid until Next is called
+     */
+    std::istream& GetStream();
 
 private:
     struct Impl;
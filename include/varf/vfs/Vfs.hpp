@@ -5,7 +5,10 @@
 #include <concepts>
 #include <cstdint>
 #include <filesystem>
+#include <memory>
+#include <optional>
 #include <ranges>
+#include <span>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -100,12 +103,13 @@ public:
     bool Contains(const std::string_view path) const;
 
     /**
-     * @brief Inserts all files contained in a zip file to the tree
+     * @brief Inserts all files contained in an archive to the tree
+     *        files are decompressed the first time they are got, not when they are inserted
      *
-     * @param stream a stream that points to the zip file
+     * @param archive the archive, the tree shares it until every one of its files was got
      * @return size_t number of added files
      */
-    size_t LoadArchive(const Archive& archive);
+    size_t LoadArchive(std::shared_ptr<const Archive> archive);
 
     /**
      * @brief Inserts all files contained in a path to the tree, does dfs to the path
@@ -122,8 +126,19 @@ private:
     struct VFile
     {
         VFile(std::vector<uint8_t>&& data);
+        VFile(std::shared_ptr<const Archive> archive, const ArchiveEntry& entry);
+
+        /**
+         * @brief Gets the data of the file, decompressing it from its archive the first time
+         */
+        std::span<const uint8_t> GetData();
+
+        size_t GetSize() const;
 
         std::vector<uint8_t> data;
+        // only set for archive files that were not decompressed yet
+        std::shared_ptr<const Archive> archive;
+        std::optional<ArchiveEntry> entry;
     };
     struct Node
     {
@@ -132,6 +147,8 @@ private:
 
     Node m_root;
 
+    bool add_file(const std::string_view path, VFile&& file);
+
     friend struct std::formatter<VTree>;
 };
 
@@ -161,7 +178,7 @@ struct std::formatter<varf::VTree>
                 }
                 else
                 {
-                    size_t size = std::get<varf::VTree::VFile>(elem).data.size();
+                    size_t size = std::get<varf::VTree::VFile>(elem).GetSize();
                     std::format_to(ctx.out(), "{}*{} [{}]\n", indentation, path, size);
                 }
             }
@@ -0,0 +1,117 @@
+#include "Archive.hpp"
+
+#include "archive/archive_internal.hpp"
+
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+namespace ranges = std::ranges;
+
+namespace varf {
+
+static fs::path get_entry_path(const std::string_view name)
+{
+    // zip-slip, names come from the archive and can not be trusted
+    const fs::path path = fs::path(name).lexically_normal();
+    Lud::check::is_false(
+        path.has_root_name() || path.has_root_directory(),
+        std::format("Entry: [{}] has an absolute path", name));
+    Lud::check::is_false(
+        ranges::any_of(path, [](const fs::path& part) { return part == ".."; }),
+        std::format("Entry: [{}] escapes the destination", name));
+
+    return path;
+}
+
+static uint64_t write_entry(std::istream& input, const fs::path& path, const std::string_view name)
+{
+    std::ofstream output(path, std::ios::binary | std::ios::trunc);
+    Lud::check::that(output.is_open(), std::format("File: [{}] could not be created", path.string()));
+
+    std::vector<char> buffer(_detail_::STREAM_WINDOW_SIZE);
+    uint64_t written = 0;
+    while (input)
+    {
+        input.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        const auto count = input.gcount();
+        output.write(buffer.data(), count);
+        written += static_cast<uint64_t>(count);
+    }
+    Lud::check::is_false(input.bad(), std::format("File: [{}] is corrupted and can not be recovered", name));
+
+    output.close();
+    Lud::check::is_false(output.fail(), std::format("File: [{}] could not be written", path.string()));
+
+    return written;
+}
+
+ExtractStats Archive::ExtractAll(const fs::path& destination, const ExtractOptions& options) const
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    ExtractStats stats;
+    const auto entries = GetDirectory();
+    // ArchiveEntry can not be assigned, so files refer to it by index to be sorted
+    std::vector<std::pair<size_t, fs::path>> files;
+    std::vector<fs::path> directories{destination};
+
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const auto& entry = entries[i];
+        const fs::path relative = get_entry_path(entry.file_name);
+        const fs::path path = destination / relative;
+
+        if (entry.file_name.ends_with('/'))
+        {
+            directories.push_back(path);
+            continue;
+        }
+        if (!options.overwrite && fs::exists(path))
+        {
+            stats.skipped++;
+            continue;
+        }
+        if (relative.has_parent_path())
+        {
+            directories.push_back(path.parent_path());
+        }
+        files.emplace_back(i, path);
+    }
+
+    // each directory is created once here instead of once per file from the workers
+    ranges::sort(directories);
+    const auto [first, last] = ranges::unique(directories);
+    directories.erase(first, last);
+    for (const auto& directory : directories)
+    {
+        if (fs::create_directories(directory))
+        {
+            stats.directories++;
+        }
+    }
+
+    // biggest entries first so a big one is not left alone at the end
+    ranges::sort(files, std::greater{}, [&](const auto& file) { return entries[file.first].uncompressed_size; });
+
+    std::atomic<uint64_t> uncompressed_bytes = 0;
+    std::atomic<uint64_t> compressed_bytes = 0;
+
+    _detail_::parallel_for(files.size(), options.threads, [&](size_t i) {
+        const auto& [index, path] = files[i];
+        const auto& entry = entries[index];
+
+        auto input = Open(entry);
+        uncompressed_bytes += write_entry(*input, path, entry.file_name);
+        compressed_bytes += entry.compressed_size;
+    });
+
+    stats.files = files.size();
+    stats.uncompressed_bytes = uncompressed_bytes;
+    stats.compressed_bytes = compressed_bytes;
+    stats.elapsed = std::chrono::steady_clock::now() - start;
+
+    return stats;
+}
+
+} // namespace varf
@@ -52,8 +52,7 @@ varf::_detail_::Context::Context()
 
 #ifdef VARF_EMBED_RESOURCES
 
-    Lud::memory_istream stream({RESOURCES_BINDUMP, RESOURCES_BINDUMP_len});
-    RezipArchive archive(stream);
-    resources.LoadArchive(archive);
+    // entries are decompressed straight from the embedded data the first time they are got
+    resources.LoadArchive(std::make_shared<const RezipArchive>(std::span<const uint8_t>{RESOURCES_BINDUMP, RESOURCES_BINDUMP_len}));
 #endif
 }
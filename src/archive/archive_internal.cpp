@@ -0,0 +1,760 @@
+#include "archive/archive_internal.hpp"
+#include "archive/crc32.hpp"
+
+#include <cctype>
+#include <cmath>
+#include <limits>
+#include <unordered_set>
+
+#include <comp_streams/CompStreams.hpp>
+#include <zlib.h>
+
+#if defined(VARF_PLATFORM_WINDOWS)
+    #define NOMINMAX
+    #define WIN32_LEAN_AND_MEAN
+    #include <Windows.h>
+#elif defined(VARF_PLATFORM_LINUX)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace varf::_detail_ {
+
+SpanStreambuf::SpanStreambuf(std::span<const uint8_t> data)
+{
+    // streambuf only works with mutable pointers, but it will never write to them
+    auto* begin = const_cast<char*>(reinterpret_cast<const char*>(data.data()));
+    setg(begin, begin, begin + data.size());
+}
+
+BufferStreambuf::BufferStreambuf(std::vector<uint8_t>&& data)
+    : SpanStreambuf(data)
+    , m_data(std::move(data))
+{
+}
+
+#if defined(VARF_PLATFORM_WINDOWS)
+
+MappedFile::MappedFile(const std::filesystem::path& path)
+{
+    m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    Lud::check::that(m_file != INVALID_HANDLE_VALUE, std::format("File: [{}] could not be opened", path.string()));
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size))
+    {
+        CloseHandle(m_file);
+        throw std::runtime_error(std::format("File: [{}] could not be opened", path.string()));
+    }
+    m_size = static_cast<size_t>(size.QuadPart);
+    // empty files can not be mapped
+    if (m_size == 0)
+    {
+        return;
+    }
+
+    m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapping != nullptr)
+    {
+        m_data = static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+    }
+    if (m_data == nullptr)
+    {
+        if (m_mapping != nullptr)
+        {
+            CloseHandle(m_mapping);
+        }
+        CloseHandle(m_file);
+        throw std::runtime_error(std::format("File: [{}] could not be mapped", path.string()));
+    }
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data != nullptr)
+    {
+        UnmapViewOfFile(m_data);
+        CloseHandle(m_mapping);
+    }
+    CloseHandle(m_file);
+}
+
+void MappedFile::WillNeed(std::span<const uint8_t>) const
+{
+}
+
+#elif defined(VARF_PLATFORM_LINUX)
+
+MappedFile::MappedFile(const std::filesystem::path& path)
+{
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    Lud::check::that(fd != -1, std::format("File: [{}] could not be opened", path.string()));
+
+    struct stat status{};
+    if (fstat(fd, &status) != 0)
+    {
+        close(fd);
+        throw std::runtime_error(std::format("File: [{}] could not be opened", path.string()));
+    }
+    m_size = static_cast<size_t>(status.st_size);
+    // empty files can not be mapped
+    if (m_size == 0)
+    {
+        close(fd);
+        return;
+    }
+
+    void* data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+    // the mapping keeps the file alive on its own
+    close(fd);
+    Lud::check::that(data != MAP_FAILED, std::format("File: [{}] could not be mapped", path.string()));
+
+    m_data = static_cast<const uint8_t*>(data);
+    // entries are read in any order, reading ahead of every fault would mostly waste io
+    madvise(data, m_size, MADV_RANDOM);
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data != nullptr)
+    {
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+    }
+}
+
+void MappedFile::WillNeed(std::span<const uint8_t> region) const
+{
+    if (region.empty())
+    {
+        return;
+    }
+    // madvise needs a page aligned address
+    static const auto page_size = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    const auto begin = reinterpret_cast<uintptr_t>(region.data()) & ~(page_size - 1);
+    const auto end = reinterpret_cast<uintptr_t>(region.data() + region.size());
+    madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+}
+
+#endif
+
+std::span<const uint8_t> MappedFile::GetData() const
+{
+    return {m_data, m_size};
+}
+
+SourceStreambuf::SourceStreambuf(std::istream& source, std::mutex& mutex, uint64_t offset, uint64_t size)
+    : m_source(source)
+    , m_mutex(mutex)
+    , m_offset(offset)
+    , m_remaining(size)
+    , m_window(std::min<uint64_t>(size, STREAM_WINDOW_SIZE))
+{
+}
+
+SourceStreambuf::int_type SourceStreambuf::underflow()
+{
+    if (gptr() < egptr())
+    {
+        return traits_type::to_int_type(*gptr());
+    }
+    if (m_remaining == 0)
+    {
+        return traits_type::eof();
+    }
+
+    const auto to_read = static_cast<std::streamsize>(std::min<uint64_t>(m_remaining, m_window.size()));
+    std::streamsize read = 0;
+    {
+        std::scoped_lock lock(m_mutex);
+        m_source.clear();
+        m_source.seekg(static_cast<std::streamoff>(m_offset), std::ios::beg);
+        m_source.read(m_window.data(), to_read);
+        read = m_source.gcount();
+    }
+    if (read <= 0)
+    {
+        return traits_type::eof();
+    }
+
+    m_offset += read;
+    m_remaining -= read;
+    setg(m_window.data(), m_window.data(), m_window.data() + read);
+
+    return traits_type::to_int_type(*gptr());
+}
+
+ForwardStreambuf::ForwardStreambuf(std::istream& source)
+    : m_source(source)
+    , m_window(STREAM_WINDOW_SIZE)
+{
+}
+
+std::span<const uint8_t> ForwardStreambuf::Fill(size_t min_size)
+{
+    auto available = static_cast<size_t>(egptr() - gptr());
+    if (available < min_size && m_source)
+    {
+        // keeps what was not read at the beginning of the window
+        std::memmove(m_window.data(), gptr(), available);
+        m_source.read(m_window.data() + available, static_cast<std::streamsize>(m_window.size() - available));
+        available += static_cast<size_t>(m_source.gcount());
+        setg(m_window.data(), m_window.data(), m_window.data() + available);
+    }
+
+    return {reinterpret_cast<const uint8_t*>(gptr()), available};
+}
+
+void ForwardStreambuf::Consume(size_t size)
+{
+    gbump(static_cast<int>(size));
+}
+
+ForwardStreambuf::int_type ForwardStreambuf::underflow()
+{
+    if (Fill(1).empty())
+    {
+        return traits_type::eof();
+    }
+    return traits_type::to_int_type(*gptr());
+}
+
+PullStreambuf::PullStreambuf(std::function<size_t(std::span<char>)> pull)
+    : m_pull(std::move(pull))
+    , m_window(STREAM_WINDOW_SIZE)
+{
+}
+
+void PullStreambuf::Reset()
+{
+    setg(nullptr, nullptr, nullptr);
+}
+
+PullStreambuf::int_type PullStreambuf::underflow()
+{
+    if (gptr() < egptr())
+    {
+        return traits_type::to_int_type(*gptr());
+    }
+
+    const size_t read = m_pull(m_window);
+    if (read == 0)
+    {
+        return traits_type::eof();
+    }
+    setg(m_window.data(), m_window.data(), m_window.data() + read);
+
+    return traits_type::to_int_type(*gptr());
+}
+
+CountingStreambuf::CountingStreambuf(std::streambuf* target)
+    : m_target(target)
+{
+}
+
+uint64_t CountingStreambuf::GetCount() const
+{
+    return m_count;
+}
+
+CountingStreambuf::int_type CountingStreambuf::overflow(int_type ch)
+{
+    if (traits_type::eq_int_type(ch, traits_type::eof()))
+    {
+        return traits_type::not_eof(ch);
+    }
+    if (traits_type::eq_int_type(m_target->sputc(traits_type::to_char_type(ch)), traits_type::eof()))
+    {
+        return traits_type::eof();
+    }
+    m_count++;
+    return ch;
+}
+
+std::streamsize CountingStreambuf::xsputn(const char* s, std::streamsize count)
+{
+    const auto written = m_target->sputn(s, count);
+    m_count += written;
+    return written;
+}
+
+int CountingStreambuf::sync()
+{
+    return m_target->pubsync();
+}
+
+CrcStreambuf::CrcStreambuf(std::streambuf* source, uint32_t expected_crc)
+    : m_source(source)
+    , m_expected_crc(expected_crc)
+    , m_window(STREAM_WINDOW_SIZE)
+{
+}
+
+CrcStreambuf::int_type CrcStreambuf::underflow()
+{
+    if (gptr() < egptr())
+    {
+        return traits_type::to_int_type(*gptr());
+    }
+
+    const auto read = m_source->sgetn(m_window.data(), static_cast<std::streamsize>(m_window.size()));
+    if (read <= 0)
+    {
+        Lud::check::eq(m_crc, m_expected_crc, "Entry is corrupted and can not be recovered");
+        return traits_type::eof();
+    }
+
+    m_crc = crc32({reinterpret_cast<const uint8_t*>(m_window.data()), static_cast<size_t>(read)}, m_crc);
+    setg(m_window.data(), m_window.data(), m_window.data() + read);
+
+    return traits_type::to_int_type(*gptr());
+}
+
+EntryIstream::EntryIstream(std::unique_ptr<std::streambuf> compressed, bool deflated, [[maybe_unused]] uint32_t crc)
+    : std::istream(nullptr)
+    , m_compressed_buffer(std::move(compressed))
+    , m_compressed(m_compressed_buffer.get())
+{
+    if (deflated)
+    {
+        m_inflate.reset(new Lud::inflate_istream(m_compressed, {.type = Lud::CompressionType::RAW}));
+        rdbuf(m_inflate->rdbuf());
+    }
+    else
+    {
+        rdbuf(m_compressed_buffer.get());
+    }
+#ifdef VARF_DO_CRC_32
+    m_crc_buffer = std::make_unique<CrcStreambuf>(rdbuf(), crc);
+    rdbuf(m_crc_buffer.get());
+#endif
+}
+
+void NameIndex::Insert(std::string_view name, size_t index)
+{
+    m_indices.emplace(name, index);
+}
+
+void NameIndex::Erase(std::string_view name, size_t index)
+{
+    const auto [first, last] = m_indices.equal_range(name);
+    const auto it = std::find_if(first, last, [&](const auto& key_index) { return key_index.second == index; });
+    if (it != last)
+    {
+        m_indices.erase(it);
+    }
+}
+
+std::optional<size_t> NameIndex::Find(std::string_view name) const
+{
+    const auto [first, last] = m_indices.equal_range(name);
+    if (first == last)
+    {
+        return std::nullopt;
+    }
+    // entries are added at the back, so the highest index is the last one added
+    return std::max_element(first, last, [](const auto& a, const auto& b) { return a.second < b.second; })->second;
+}
+
+void NameIndex::Clear()
+{
+    m_indices.clear();
+}
+
+SpanReader::SpanReader(std::span<const uint8_t> data)
+    : m_data(data)
+{
+}
+
+std::span<const uint8_t> SpanReader::ReadBytes(size_t size)
+{
+    Lud::check::that(size <= m_data.size(), "Unexpected end of directory");
+
+    const auto bytes = m_data.first(size);
+    m_data = m_data.subspan(size);
+    return bytes;
+}
+
+size_t SpanReader::GetRemaining() const
+{
+    return m_data.size();
+}
+
+namespace {
+
+// samples taken across the data to estimate its entropy
+constexpr size_t ENTROPY_SAMPLE_COUNT = 4;
+constexpr size_t ENTROPY_SAMPLE_SIZE = 0x1000;
+// below this the estimate is meaningless and deflating is cheap anyway
+constexpr size_t ENTROPY_MIN_SIZE = 0x400;
+
+bool has_extension(std::string_view name, const std::vector<std::string>& extensions)
+{
+    return std::ranges::any_of(extensions, [name](const std::string& extension) {
+        return name.size() >= extension.size()
+            && std::ranges::equal(name.substr(name.size() - extension.size()), extension, [](char a, char b) {
+                   return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+               });
+    });
+}
+
+// shannon entropy of the byte histogram, in bits per byte
+double estimate_entropy(std::span<const uint8_t> data)
+{
+    std::array<uint32_t, 256> histogram{};
+    size_t sampled = 0;
+
+    const auto add_sample = [&](std::span<const uint8_t> sample) {
+        for (const uint8_t byte : sample)
+        {
+            histogram[byte]++;
+        }
+        sampled += sample.size();
+    };
+
+    if (data.size() <= ENTROPY_SAMPLE_COUNT * ENTROPY_SAMPLE_SIZE)
+    {
+        add_sample(data);
+    }
+    else
+    {
+        const size_t stride = (data.size() - ENTROPY_SAMPLE_SIZE) / (ENTROPY_SAMPLE_COUNT - 1);
+        for (size_t i = 0; i < ENTROPY_SAMPLE_COUNT; i++)
+        {
+            add_sample(data.subspan(i * stride, ENTROPY_SAMPLE_SIZE));
+        }
+    }
+
+    double entropy = 0.0;
+    for (const uint32_t count : histogram)
+    {
+        if (count > 0)
+        {
+            const double probability = static_cast<double>(count) / static_cast<double>(sampled);
+            entropy -= probability * std::log2(probability);
+        }
+    }
+    return entropy;
+}
+
+} // namespace
+
+ArchiveCompression choose_compression(std::string_view name, std::span<const uint8_t> data, const CompressionPolicy& policy)
+{
+    if (policy.compression == archive_compression::none || data.empty())
+    {
+        return archive_compression::none;
+    }
+    if (has_extension(name, policy.deflated_extensions))
+    {
+        return archive_compression::deflate;
+    }
+    if (has_extension(name, policy.stored_extensions))
+    {
+        return archive_compression::none;
+    }
+    if (data.size() >= ENTROPY_MIN_SIZE && policy.max_entropy < 8.0 && estimate_entropy(data) > policy.max_entropy)
+    {
+        return archive_compression::none;
+    }
+    return archive_compression::deflate;
+}
+
+bool deflate_raw(std::span<const uint8_t> input, int level, std::vector<uint8_t>& output, std::span<const uint8_t> dictionary)
+{
+    z_stream stream{};
+    Lud::check::that(
+        deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK,
+        "Could not initialize deflate"
+    );
+    if (!dictionary.empty())
+    {
+        deflateSetDictionary(&stream, dictionary.data(), static_cast<uInt>(dictionary.size()));
+    }
+
+    // a bigger output is never needed, the data would be stored instead
+    output.resize(input.size());
+
+    // zlib counts with uInt, big data is fed in chunks
+    constexpr size_t max_chunk = std::numeric_limits<uInt>::max();
+    size_t read = 0;
+    size_t written = 0;
+    int result = Z_OK;
+    while (result == Z_OK && written < output.size())
+    {
+        const size_t in_chunk = std::min(input.size() - read, max_chunk);
+        const size_t out_chunk = std::min(output.size() - written, max_chunk);
+        stream.next_in = const_cast<Bytef*>(input.data() + read);
+        stream.avail_in = static_cast<uInt>(in_chunk);
+        stream.next_out = output.data() + written;
+        stream.avail_out = static_cast<uInt>(out_chunk);
+
+        result = deflate(&stream, read + in_chunk == input.size() ? Z_FINISH : Z_NO_FLUSH);
+
+        read += in_chunk - stream.avail_in;
+        written += out_chunk - stream.avail_out;
+    }
+    deflateEnd(&stream);
+
+    if (result != Z_STREAM_END || written >= input.size())
+    {
+        return false;
+    }
+    output.resize(written);
+    return true;
+}
+
+void deflate_raw_chunk(std::span<const uint8_t> input, int level, bool final, std::vector<uint8_t>& output)
+{
+    // zlib counts with uInt, chunks are expected to be far smaller
+    Lud::check::that(input.size() <= std::numeric_limits<uInt>::max(), "Chunk is too big");
+
+    z_stream stream{};
+    Lud::check::that(
+        deflateInit2(&stream, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK,
+        "Could not initialize deflate"
+    );
+
+    // deflateBound covers Z_FINISH, a full flush adds an empty stored block of 5 bytes at most
+    output.resize(deflateBound(&stream, static_cast<uLong>(input.size())) + 5);
+
+    stream.next_in = const_cast<Bytef*>(input.data());
+    stream.avail_in = static_cast<uInt>(input.size());
+    stream.next_out = output.data();
+    stream.avail_out = static_cast<uInt>(output.size());
+
+    const int result = deflate(&stream, final ? Z_FINISH : Z_FULL_FLUSH);
+    const size_t written = output.size() - stream.avail_out;
+    deflateEnd(&stream);
+
+    Lud::check::that(
+        final ? result == Z_STREAM_END : result == Z_OK && stream.avail_in == 0,
+        "Could not compress chunk"
+    );
+    output.resize(written);
+}
+
+namespace {
+
+struct Inflater
+{
+    z_stream stream{};
+    bool initialized{false};
+
+    Inflater() = default;
+    Inflater(const Inflater&) = delete;
+    Inflater& operator=(const Inflater&) = delete;
+
+    ~Inflater()
+    {
+        if (initialized)
+        {
+            inflateEnd(&stream);
+        }
+    }
+};
+
+} // namespace
+
+bool inflate_raw(std::span<const uint8_t> input, std::span<uint8_t> output, bool final, std::span<const uint8_t> dictionary)
+{
+    thread_local Inflater inflater;
+    z_stream& stream = inflater.stream;
+    if (inflater.initialized)
+    {
+        inflateReset(&stream);
+    }
+    else
+    {
+        Lud::check::that(inflateInit2(&stream, -MAX_WBITS) == Z_OK, "Could not initialize inflate");
+        inflater.initialized = true;
+    }
+    // raw streams take the dictionary before any data
+    if (!dictionary.empty())
+    {
+        inflateSetDictionary(&stream, dictionary.data(), static_cast<uInt>(dictionary.size()));
+    }
+
+    // once output is full inflating continues into a single byte, if anything lands there the data was too big
+    uint8_t overflow = 0;
+    constexpr size_t max_chunk = std::numeric_limits<uInt>::max();
+    size_t read = 0;
+    size_t written = 0;
+    int result = Z_OK;
+    while (result == Z_OK)
+    {
+        const size_t in_chunk = std::min(input.size() - read, max_chunk);
+        const size_t out_chunk = std::min(output.size() - written, max_chunk);
+        stream.next_in = const_cast<Bytef*>(input.data() + read);
+        stream.avail_in = static_cast<uInt>(in_chunk);
+        stream.next_out = out_chunk > 0 ? output.data() + written : &overflow;
+        stream.avail_out = out_chunk > 0 ? static_cast<uInt>(out_chunk) : 1;
+
+        result = inflate(&stream, Z_NO_FLUSH);
+
+        read += in_chunk - stream.avail_in;
+        if (out_chunk == 0)
+        {
+            if (stream.avail_out == 0)
+            {
+                result = Z_DATA_ERROR;
+            }
+            continue;
+        }
+        written += out_chunk - stream.avail_out;
+    }
+
+    if (!final)
+    {
+        // the chunk does not end the stream, inflate stops once it runs out of input
+        return result == Z_BUF_ERROR && read == input.size() && written == output.size();
+    }
+    return result == Z_STREAM_END && written == output.size();
+}
+
+std::vector<uint8_t> train_dictionary(std::span<const std::span<const uint8_t>> samples, size_t size)
+{
+    constexpr size_t gram_size = 8;
+    constexpr size_t segment_size = 64;
+
+    const auto read_gram = [](const uint8_t* data) {
+        uint64_t gram;
+        std::memcpy(&gram, data, sizeof(gram));
+        return gram;
+    };
+
+    // in how many samples each sequence appears, counted once per sample
+    std::unordered_map<uint64_t, uint32_t> sample_count;
+    std::unordered_map<uint64_t, size_t> last_sample;
+    for (size_t i = 0; i < samples.size(); i++)
+    {
+        const auto sample = samples[i];
+        for (size_t pos = 0; pos + gram_size <= sample.size(); pos++)
+        {
+            const uint64_t gram = read_gram(sample.data() + pos);
+            auto [it, inserted] = last_sample.try_emplace(gram, i);
+            if (inserted || it->second != i)
+            {
+                it->second = i;
+                sample_count[gram]++;
+            }
+        }
+    }
+
+    struct segment
+    {
+        std::span<const uint8_t> data;
+        uint64_t score;
+    };
+    std::vector<segment> segments;
+    for (const auto sample : samples)
+    {
+        for (size_t begin = 0; begin < sample.size(); begin += segment_size)
+        {
+            const auto data = sample.subspan(begin, std::min(segment_size, sample.size() - begin));
+            uint64_t score = 0;
+            for (size_t pos = 0; pos + gram_size <= data.size(); pos++)
+            {
+                // sequences in a single sample are not worth keeping
+                const uint32_t count = sample_count[read_gram(data.data() + pos)];
+                score += count > 1 ? count : 0;
+            }
+            if (score > 0)
+            {
+                segments.emplace_back(data, score);
+            }
+        }
+    }
+
+    std::ranges::stable_sort(segments, std::greater{}, &segment::score);
+
+    // the best segments are picked first, then written in reverse so they end up last
+    std::vector<std::span<const uint8_t>> picked;
+    // keyed on the bytes, keying on a hash would drop distinct segments that collide
+    std::unordered_set<std::string_view> picked_segments;
+    size_t picked_size = 0;
+    for (const auto& [data, score] : segments)
+    {
+        if (picked_size + data.size() > size)
+        {
+            continue;
+        }
+        // identical segments from different samples are only kept once
+        const std::string_view bytes(reinterpret_cast<const char*>(data.data()), data.size());
+        if (!picked_segments.insert(bytes).second)
+        {
+            continue;
+        }
+        picked.push_back(data);
+        picked_size += data.size();
+    }
+
+    std::vector<uint8_t> dictionary;
+    dictionary.reserve(picked_size);
+    for (const auto& data : picked | std::views::reverse)
+    {
+        dictionary.insert(dictionary.end(), data.begin(), data.end());
+    }
+
+    return dictionary;
+}
+
+void parallel_for(size_t count, unsigned int threads, const std::function<void(size_t)>& task)
+{
+    if (threads == 0)
+    {
+        threads = std::max(1U, std::thread::hardware_concurrency());
+    }
+    threads = static_cast<unsigned int>(std::min<size_t>(threads, count));
+
+    if (threads <= 1)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            task(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next = 0;
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    const auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++)
+        {
+            try
+            {
+                task(i);
+            }
+            catch (...)
+            {
+                std::scoped_lock lock(error_mutex);
+                if (!error)
+                {
+                    error = std::current_exception();
+                }
+                next = count;
+            }
+        }
+    };
+
+    // scoped so every thread is joined before checking for errors
+    {
+        std::vector<std::jthread> pool;
+        pool.reserve(threads - 1);
+        for (unsigned int i = 0; i < threads - 1; i++)
+        {
+            pool.emplace_back(worker);
+        }
+        worker();
+    }
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+} // namespace varf::_detail_
@@ -0,0 +1,449 @@
+#ifndef VARF_ARCHIVE_INTERNAL_HEADER
+#define VARF_ARCHIVE_INTERNAL_HEADER
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <streambuf>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <varf/Archive.hpp>
+
+namespace varf::_detail_ {
+
+/**
+ * @brief size of the read window used when streaming entries from a source
+ *        twice the deflate window so inflate always has a full window available
+ */
+constexpr size_t STREAM_WINDOW_SIZE = 0x10000;
+
+/**
+ * @brief maps entry names to their index in the archive
+ *        every entry has its own key viewing its own name, so the entries must not move,
+ *        removing one never leaves a key viewing a freed name and lookups with a string_view do not allocate
+ *        if several entries share a name the one with the highest index is found
+ */
+class NameIndex
+{
+public:
+    void Insert(std::string_view name, size_t index);
+
+    /**
+     * @brief Removes the entry at index, other entries with the same name can still be found
+     */
+    void Erase(std::string_view name, size_t index);
+
+    std::optional<size_t> Find(std::string_view name) const;
+
+    void Clear();
+
+private:
+    std::unordered_multimap<std::string_view, size_t> m_indices;
+};
+
+/**
+ * @brief stores archive entries in slots that never move, so indices stay valid across removals
+ *        values are always added at the back, so slot order is the order they were added in
+ *        removed slots release their value but are not reused, the generation of the slot is increased
+ *        so a handle is only valid if both its index and its generation match
+ */
+template <typename T>
+class SlotMap
+{
+public:
+    /**
+     * @brief Adds a value at the back, freed slots are not reused so the order of the values is kept
+     *
+     * @return size_t the index of the slot
+     */
+    size_t Insert(T&& value)
+    {
+        m_size++;
+        m_slots.emplace_back(std::move(value), 0, true);
+        return m_slots.size() - 1;
+    }
+
+    /**
+     * @brief Removes the value in a slot in constant time, releasing its memory
+     *        the generation of the slot is increased so old handles become invalid
+     */
+    void Erase(size_t index)
+    {
+        auto& slot = m_slots[index];
+        slot.value = T{};
+        slot.alive = false;
+        slot.generation++;
+        m_size--;
+    }
+
+    bool Contains(size_t index, uint32_t generation) const
+    {
+        return IsAlive(index) && m_slots[index].generation == generation;
+    }
+
+    bool IsAlive(size_t index) const
+    {
+        return index < m_slots.size() && m_slots[index].alive;
+    }
+
+    uint32_t GetGeneration(size_t index) const
+    {
+        return m_slots[index].generation;
+    }
+
+    T& operator[](size_t index)
+    {
+        return m_slots[index].value;
+    }
+
+    const T& operator[](size_t index) const
+    {
+        return m_slots[index].value;
+    }
+
+    /**
+     * @brief number of values stored
+     */
+    size_t GetSize() const
+    {
+        return m_size;
+    }
+
+    /**
+     * @brief number of slots, including the free ones, valid indices are below it
+     */
+    size_t GetSlotCount() const
+    {
+        return m_slots.size();
+    }
+
+    /**
+     * @brief view of the stored values in slot order
+     */
+    auto Values()
+    {
+        return m_slots | std::views::filter(&Slot::alive) | std::views::transform(&Slot::value);
+    }
+
+    auto Values() const
+    {
+        return m_slots | std::views::filter(&Slot::alive) | std::views::transform(&Slot::value);
+    }
+
+private:
+    struct Slot
+    {
+        T value;
+        uint32_t generation;
+        bool alive;
+    };
+
+    // a deque so values do not move when slots are added
+    std::deque<Slot> m_slots;
+    size_t m_size{0};
+};
+
+/**
+ * @brief read only streambuf over memory owned by someone else
+ */
+class SpanStreambuf : public std::streambuf
+{
+public:
+    SpanStreambuf(std::span<const uint8_t> data);
+};
+
+/**
+ * @brief read only streambuf over memory it owns
+ */
+class BufferStreambuf : public SpanStreambuf
+{
+public:
+    BufferStreambuf(std::vector<uint8_t>&& data);
+
+private:
+    std::vector<uint8_t> m_data;
+};
+
+/**
+ * @brief read only memory mapping of a whole file
+ *        pages are read by the OS on first access and stay in the page cache,
+ *        which is shared by every process mapping the same file
+ */
+class MappedFile
+{
+public:
+    /**
+     * @throws std::runtime_error if the file can not be opened or mapped
+     */
+    MappedFile(const std::filesystem::path& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&&) = delete;
+    MappedFile& operator=(MappedFile&&) = delete;
+
+    std::span<const uint8_t> GetData() const;
+
+    /**
+     * @brief Hints that a region is about to be read so the OS reads it ahead
+     *        instead of faulting in one page at a time, it does nothing where not supported
+     *
+     * @param region part of the data
+     */
+    void WillNeed(std::span<const uint8_t> region) const;
+
+private:
+    const uint8_t* m_data{nullptr};
+    size_t m_size{0};
+#ifdef VARF_PLATFORM_WINDOWS
+    void* m_file{nullptr};
+    void* m_mapping{nullptr};
+#endif
+};
+
+/**
+ * @brief forward only streambuf over a region of a stream shared with other readers
+ *        reads are done in windows of STREAM_WINDOW_SIZE while holding the mutex
+ */
+class SourceStreambuf : public std::streambuf
+{
+public:
+    SourceStreambuf(std::istream& source, std::mutex& mutex, uint64_t offset, uint64_t size);
+
+protected:
+    int_type underflow() override;
+
+private:
+    std::istream& m_source;
+    std::mutex& m_mutex;
+    uint64_t m_offset;
+    uint64_t m_remaining;
+
+    std::vector<char> m_window;
+};
+
+/**
+ * @brief read only streambuf over a stream that can not seek
+ *        its buffer can be accessed directly so a decoder can consume exactly what it needs
+ *        and leave the rest to be read by whatever follows
+ */
+class ForwardStreambuf : public std::streambuf
+{
+public:
+    ForwardStreambuf(std::istream& source);
+
+    /**
+     * @brief Obtains the buffered bytes, reading from the source if there are less than min_size
+     *
+     * @return std::span<const uint8_t> the buffered bytes, less than min_size only at the end of the source
+     */
+    std::span<const uint8_t> Fill(size_t min_size);
+
+    /**
+     * @brief Marks buffered bytes as read
+     */
+    void Consume(size_t size);
+
+protected:
+    int_type underflow() override;
+
+private:
+    std::istream& m_source;
+
+    std::vector<char> m_window;
+};
+
+/**
+ * @brief read only streambuf that obtains its data from a function as it is read
+ *        the function returns how many bytes it wrote, 0 at the end of the data
+ */
+class PullStreambuf : public std::streambuf
+{
+public:
+    PullStreambuf(std::function<size_t(std::span<char>)> pull);
+
+    /**
+     * @brief Discards the buffered data, used when the source of the data changes
+     */
+    void Reset();
+
+protected:
+    int_type underflow() override;
+
+private:
+    std::function<size_t(std::span<char>)> m_pull;
+
+    std::vector<char> m_window;
+};
+
+/**
+ * @brief write only streambuf that forwards to another one counting the written bytes
+ *        used to know offsets when writing to streams that can not tell their position
+ */
+class CountingStreambuf : public std::streambuf
+{
+public:
+    CountingStreambuf(std::streambuf* target);
+
+    uint64_t GetCount() const;
+
+protected:
+    int_type overflow(int_type ch) override;
+    std::streamsize xsputn(const char* s, std::streamsize count) override;
+    int sync() override;
+
+private:
+    std::streambuf* m_target;
+    uint64_t m_count{0};
+};
+
+/**
+ * @brief read only streambuf that computes the crc of the data read from another one
+ *        when the source is exhausted the crc is checked and a mismatch throws,
+ *        which sets the badbit of the istream reading from it
+ */
+class CrcStreambuf : public std::streambuf
+{
+public:
+    CrcStreambuf(std::streambuf* source, uint32_t expected_crc);
+
+protected:
+    int_type underflow() override;
+
+private:
+    std::streambuf* m_source;
+    uint32_t m_expected_crc;
+    uint32_t m_crc{0};
+
+    std::vector<char> m_window;
+};
+
+/**
+ * @brief istream returned by Archive::Open, owns the compressed data streambuf
+ *        and inflates from it on demand when the entry is deflated
+ *        when VARF_DO_CRC_32 is defined the crc of the entry is verified at the end of the data
+ */
+class EntryIstream : public std::istream
+{
+public:
+    EntryIstream(std::unique_ptr<std::streambuf> compressed, bool deflated, uint32_t crc);
+
+private:
+    std::unique_ptr<std::streambuf> m_compressed_buffer;
+    std::istream m_compressed;
+    std::unique_ptr<std::istream> m_inflate;
+    std::unique_ptr<CrcStreambuf> m_crc_buffer;
+};
+
+/**
+ * @brief reads binary fields from memory, used to parse a directory loaded with a single read
+ *        instead of issuing a stream read per field
+ */
+class SpanReader
+{
+public:
+    SpanReader(std::span<const uint8_t> data);
+
+    /**
+     * @brief Reads sizeof(T) bytes into value
+     * @throws std::runtime_error if there are not enough bytes left
+     */
+    template <typename T>
+    void Read(T& value)
+    {
+        std::memcpy(&value, ReadBytes(sizeof(value)).data(), sizeof(value));
+    }
+
+    /**
+     * @brief Obtains the next bytes without copying them
+     * @throws std::runtime_error if there are not enough bytes left
+     */
+    std::span<const uint8_t> ReadBytes(size_t size);
+
+    size_t GetRemaining() const;
+
+private:
+    std::span<const uint8_t> m_data;
+};
+
+/**
+ * @brief Chooses how an entry is compressed following a policy
+ *        the entropy is estimated from a few samples of the data, not the whole of it
+ *
+ * @param name name of the entry, used for its extension
+ * @param data uncompressed data of the entry
+ * @param policy the policy to follow
+ * @return ArchiveCompression archive_compression::none if deflating is not worth it
+ */
+ArchiveCompression choose_compression(std::string_view name, std::span<const uint8_t> data, const CompressionPolicy& policy);
+
+/**
+ * @brief Compresses data as a raw deflate stream
+ *        gives up as soon as the output is not smaller than the input, as it would be stored anyway
+ *
+ * @param input the data to be compressed
+ * @param level deflate level
+ * @param output receives the compressed data
+ * @param dictionary preset dictionary, the same one has to be given to inflate_raw
+ * @return bool false if the data did not get smaller, output is unspecified then
+ */
+bool deflate_raw(std::span<const uint8_t> input, int level, std::vector<uint8_t>& output, std::span<const uint8_t> dictionary = {});
+
+/**
+ * @brief Compresses data as one chunk of a raw deflate stream, without referencing any data before it
+ *        so it can be inflated on its own, chunks end byte aligned so they can be concatenated into a single stream
+ *
+ * @param input the data to be compressed
+ * @param level deflate level
+ * @param final if this is the last chunk of the stream, only that one ends it
+ * @param output receives the compressed data
+ */
+void deflate_raw_chunk(std::span<const uint8_t> input, int level, bool final, std::vector<uint8_t>& output);
+
+/**
+ * @brief Decompresses a raw deflate stream straight into memory owned by the caller
+ *        the inflate state is kept by each thread and reused, as setting it up costs more than inflating small entries
+ *
+ * @param input the compressed data
+ * @param output receives the decompressed data, its size must be the exact decompressed size
+ * @param final false if input is a chunk from deflate_raw_chunk that does not end the stream
+ * @param dictionary preset dictionary the data was compressed with
+ * @return bool false if the data is corrupted or does not decompress to exactly output.size() bytes
+ */
+bool inflate_raw(std::span<const uint8_t> input, std::span<uint8_t> output, bool final = true, std::span<const uint8_t> dictionary = {});
+
+/**
+ * @brief Builds a preset dictionary from samples of the data it will be used with
+ *        samples are split in segments, segments whose 8 byte sequences appear in the most samples
+ *        are kept, the most common ones last as deflate reaches closer data with shorter codes
+ *
+ * @param samples the data of some entries
+ * @param size maximum size of the dictionary, deflate can not use more than 32 KiB
+ * @return std::vector<uint8_t> the dictionary, empty if the samples have nothing in common
+ */
+std::vector<uint8_t> train_dictionary(std::span<const std::span<const uint8_t>> samples, size_t size);
+
+/**
+ * @brief Calls task for every index in [0, count) using a pool of threads
+ *        if any task throws the remaining ones are skipped and the first exception is rethrown
+ *
+ * @param count number of tasks
+ * @param threads number of threads used, 0 to use all available
+ * @param task the task to be called with each index
+ */
+void parallel_for(size_t count, unsigned int threads, const std::function<void(size_t)>& task);
+
+} // namespace varf::_detail_
+
+#endif // !VARF_ARCHIVE_INTERNAL_HEADER
@@ -0,0 +1,257 @@
+#include "archive/crc32.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+    #define VARF_CRC32_X86
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+    #define VARF_CRC32_ARM
+    #include <arm_acle.h>
+    #if defined(__linux__)
+        #include <sys/auxv.h>
+    #elif defined(_WIN32)
+        #include <Windows.h>
+    #endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+    #define VARF_TARGET(x) __attribute__((target(x)))
+#else
+    #define VARF_TARGET(x)
+#endif
+
+namespace varf::_detail_ {
+
+namespace {
+
+// reflected polynomial 0x04C11DB7
+constexpr uint32_t CRC32_POLYNOMIAL = 0xEDB88320;
+
+using crc32_function = uint32_t (*)(std::span<const uint8_t> data, uint32_t crc);
+
+constexpr auto make_slicing_tables()
+{
+    std::array<std::array<uint32_t, 256>, 8> tables{};
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLYNOMIAL : 0);
+        }
+        tables[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        for (size_t table = 1; table < tables.size(); table++)
+        {
+            const uint32_t previous = tables[table - 1][i];
+            tables[table][i] = (previous >> 8) ^ tables[0][previous & 0xFF];
+        }
+    }
+    return tables;
+}
+
+constexpr auto SLICING_TABLES = make_slicing_tables();
+
+// works on the inverted crc, callers handle the inversion
+uint32_t crc32_slicing_by_8(std::span<const uint8_t> data, uint32_t crc)
+{
+    const auto& t = SLICING_TABLES;
+
+    const uint8_t* ptr = data.data();
+    size_t size = data.size();
+    while (size >= 8)
+    {
+        uint32_t low;
+        uint32_t high;
+        std::memcpy(&low, ptr, 4);
+        std::memcpy(&high, ptr + 4, 4);
+        low ^= crc;
+        crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^ t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24]
+            ^ t[3][high & 0xFF] ^ t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^ t[0][high >> 24];
+        ptr += 8;
+        size -= 8;
+    }
+    while (size-- > 0)
+    {
+        crc = (crc >> 8) ^ t[0][(crc ^ *ptr++) & 0xFF];
+    }
+    return crc;
+}
+
+#ifdef VARF_CRC32_X86
+
+VARF_TARGET("sse2")
+inline __m128i load(const uint8_t* ptr)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr));
+}
+
+// multiplies both halves of x by their constant in k and adds the next block
+VARF_TARGET("pclmul,sse2")
+inline __m128i fold(__m128i x, __m128i k, __m128i next)
+{
+    const __m128i low = _mm_clmulepi64_si128(x, k, 0x00);
+    const __m128i high = _mm_clmulepi64_si128(x, k, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(high, low), next);
+}
+
+/**
+ * folds 64 bytes at a time with carry-less multiplications and then does a barret reduction
+ * "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction", Intel 2009
+ * constants are the ones for the reflected zip polynomial given at the end of the paper
+ */
+VARF_TARGET("pclmul,sse4.1")
+uint32_t crc32_pclmul(std::span<const uint8_t> data, uint32_t crc)
+{
+    // the folding needs at least 4 blocks to begin
+    if (data.size() < 64)
+    {
+        return crc32_slicing_by_8(data, crc);
+    }
+
+    alignas(16) static constexpr uint64_t k1k2[] = {0x0154442bd4, 0x01c6e41596};
+    alignas(16) static constexpr uint64_t k3k4[] = {0x01751997d0, 0x00ccaa009e};
+    alignas(16) static constexpr uint64_t k5k0[] = {0x0163cd6124, 0x0000000000};
+    alignas(16) static constexpr uint64_t poly[] = {0x01db710641, 0x01f7011641};
+
+    const uint8_t* ptr = data.data();
+    size_t size = data.size() & ~size_t{15};
+
+    __m128i x1 = _mm_xor_si128(load(ptr + 0x00), _mm_cvtsi32_si128(static_cast<int>(crc)));
+    __m128i x2 = load(ptr + 0x10);
+    __m128i x3 = load(ptr + 0x20);
+    __m128i x4 = load(ptr + 0x30);
+    ptr += 64;
+    size -= 64;
+
+    __m128i k = _mm_load_si128(reinterpret_cast<const __m128i*>(k1k2));
+    while (size >= 64)
+    {
+        x1 = fold(x1, k, load(ptr + 0x00));
+        x2 = fold(x2, k, load(ptr + 0x10));
+        x3 = fold(x3, k, load(ptr + 0x20));
+        x4 = fold(x4, k, load(ptr + 0x30));
+        ptr += 64;
+        size -= 64;
+    }
+
+    // fold the 4 blocks into one
+    k = _mm_load_si128(reinterpret_cast<const __m128i*>(k3k4));
+    x1 = fold(x1, k, x2);
+    x1 = fold(x1, k, x3);
+    x1 = fold(x1, k, x4);
+
+    while (size >= 16)
+    {
+        x1 = fold(x1, k, load(ptr));
+        ptr += 16;
+        size -= 16;
+    }
+
+    // fold 128 bits to 64 bits
+    const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x2_fold = _mm_clmulepi64_si128(x1, k, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2_fold);
+
+    k = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(k5k0));
+    x2_fold = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask);
+    x1 = _mm_clmulepi64_si128(x1, k, 0x00);
+    x1 = _mm_xor_si128(x1, x2_fold);
+
+    // barret reduction to 32 bits
+    k = _mm_load_si128(reinterpret_cast<const __m128i*>(poly));
+    x2_fold = _mm_and_si128(x1, mask);
+    x2_fold = _mm_clmulepi64_si128(x2_fold, k, 0x10);
+    x2_fold = _mm_and_si128(x2_fold, mask);
+    x2_fold = _mm_clmulepi64_si128(x2_fold, k, 0x00);
+    x1 = _mm_xor_si128(x1, x2_fold);
+
+    crc = static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+
+    return crc32_slicing_by_8(data.subspan(data.size() & ~size_t{15}), crc);
+}
+
+bool cpu_has_pclmul()
+{
+    #ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    constexpr int pclmul_bit = 1 << 1;
+    constexpr int sse41_bit = 1 << 19;
+    return (info[2] & pclmul_bit) && (info[2] & sse41_bit);
+    #else
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+    #endif
+}
+
+#endif // VARF_CRC32_X86
+
+#ifdef VARF_CRC32_ARM
+
+VARF_TARGET("+crc")
+uint32_t crc32_arm(std::span<const uint8_t> data, uint32_t crc)
+{
+    const uint8_t* ptr = data.data();
+    size_t size = data.size();
+    while (size >= 8)
+    {
+        uint64_t value;
+        std::memcpy(&value, ptr, 8);
+        crc = __crc32d(crc, value);
+        ptr += 8;
+        size -= 8;
+    }
+    while (size-- > 0)
+    {
+        crc = __crc32b(crc, *ptr++);
+    }
+    return crc;
+}
+
+bool cpu_has_arm_crc()
+{
+    #if defined(__ARM_FEATURE_CRC32) || defined(__APPLE__)
+    return true;
+    #elif defined(__linux__)
+    constexpr unsigned long hwcap_crc32 = 1 << 7;
+    return getauxval(AT_HWCAP) & hwcap_crc32;
+    #elif defined(_WIN32)
+    return IsProcessorFeaturePresent(PF_ARM_V8_CRC32_INSTRUCTIONS_AVAILABLE);
+    #else
+    return false;
+    #endif
+}
+
+#endif // VARF_CRC32_ARM
+
+crc32_function select_crc32()
+{
+#if defined(VARF_CRC32_X86)
+    if (cpu_has_pclmul())
+    {
+        return crc32_pclmul;
+    }
+#elif defined(VARF_CRC32_ARM)
+    if (cpu_has_arm_crc())
+    {
+        return crc32_arm;
+    }
+#endif
+    return crc32_slicing_by_8;
+}
+
+} // namespace
+
+uint32_t crc32(std::span<const uint8_t> data, uint32_t crc)
+{
+    static const crc32_function implementation = select_crc32();
+
+    return ~implementation(data, ~crc);
+}
+
+} // namespace varf::_detail_
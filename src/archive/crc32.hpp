@@ -0,0 +1,22 @@
+#ifndef VARF_CRC32_HEADER
+#define VARF_CRC32_HEADER
+
+#include <cstdint>
+#include <span>
+
+namespace varf::_detail_ {
+
+/**
+ * @brief Updates a CRC-32 (the one used by zip, gzip and png) with more data
+ *        uses PCLMULQDQ on x86 or the crc instructions on ARMv8 when the cpu supports them,
+ *        otherwise falls back to slicing by 8, the implementation is chosen on first use
+ *
+ * @param data the data to be added to the crc
+ * @param crc the crc of the previous data, 0 for the first call
+ * @return uint32_t the updated crc
+ */
+uint32_t crc32(std::span<const uint8_t> data, uint32_t crc = 0);
+
+} // namespace varf::_detail_
+
+#endif // !VARF_CRC32_HEADER
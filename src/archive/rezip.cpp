@@ -1,4 +1,11 @@
 #include "archive/rezip.hpp"
+#include "archive/archive_internal.hpp"
+#include "archive/crc32.hpp"
+
+#include <bit>
+#include <deque>
+#include <limits>
+#include <numeric>
 
 #include <comp_streams/CompStreams.hpp>
 
@@ -16,7 +23,9 @@ enum Enum : uint32_t
 {
     LOCAL_FILE_HEADER = 0x0405564C,
     CENTRAL_DIRECTORY_HEADER = 0x0201564C,
+    SOLID_CENTRAL_DIRECTORY_HEADER = 0x0203564C,
     END_OF_CENTRAL_DIRECTORY_RECORD = 0x0605564C,
+    EXTENSION_RECORD = 0x0807564C,
 };
 }; // namespace signatures_NS
 
@@ -24,12 +33,27 @@ namespace compression_method_NS {
 enum Enum : uint8_t // NOLINT
 {
     DEFLATE = 8,
+    // a deflate stream made of independently compressed chunks, preceded by a chunk table
+    DEFLATE_CHUNKED = 0x80 | DEFLATE,
+    // a deflate stream compressed with the preset dictionary of the archive
+    DEFLATE_DICTIONARY = 0x40 | DEFLATE,
+    // only used in memory, the entry is part of a solid block
+    SOLID = 0x20,
     NONE = 0,
 };
 }; // namespace compression_method_NS
 
+namespace extension_type_NS {
+enum Enum : uint32_t
+{
+    DICTIONARY = 1,
+    NAME_INDEX = 2,
+};
+}; // namespace extension_type_NS
+
 using Signatures = signatures_NS::Enum;
 using CompressionMethod = compression_method_NS::Enum;
+using ExtensionType = extension_type_NS::Enum;
 
 struct LocalFileHeader
 {
@@ -45,6 +69,18 @@ struct CentralDirectoryHeader
     uint64_t offset{};
     uint32_t signature{};
     uint32_t file_name_length{};
+    // only for entries in a solid block, offset is the one of the block
+    uint64_t offset_in_block{};
+    uint64_t uncompressed_size{};
+    uint32_t CRC_32{};
+};
+// optional records after the central directory headers, readers skip the types they do not know
+struct ExtensionRecord
+{
+    uint32_t signature{};
+    uint32_t type{};
+    uint64_t size{};
+    std::span<const uint8_t> data{};
 };
 struct EndOfCentralDirectoryRecord
 {
@@ -53,6 +89,65 @@ struct EndOfCentralDirectoryRecord
     uint32_t signature{};
     uint32_t directory_record_number{};
 };
+// viewed from the compressed data of a chunked entry, nothing is copied
+struct ChunkTable
+{
+    uint32_t chunk_size{};
+    uint32_t chunk_count{};
+    // 8 bytes per chunk, where it ends in data
+    std::span<const uint8_t> chunk_ends{};
+    // the deflate stream
+    std::span<const uint8_t> data{};
+
+    uint64_t GetChunkEnd(size_t chunk) const
+    {
+        uint64_t end;
+        std::memcpy(&end, chunk_ends.data() + chunk * sizeof(end), sizeof(end));
+        return end;
+    }
+
+    std::span<const uint8_t> GetChunk(size_t chunk) const
+    {
+        const uint64_t begin = chunk == 0 ? 0 : GetChunkEnd(chunk - 1);
+        return data.subspan(begin, GetChunkEnd(chunk) - begin);
+    }
+};
+// viewed from a name index extension record, entries are numbered in central directory order
+struct NameIndexTable
+{
+    uint32_t slot_count{};
+    uint32_t entry_count{};
+    // 8 bytes per slot, a tag from the hash of the name and the entry number + 1, 0 if empty
+    std::span<const uint8_t> slots{};
+    // 4 bytes per entry, the entry numbers sorted by name
+    std::span<const uint8_t> sorted_entries{};
+    // 8 bytes per entry, where its header is in the central directory
+    std::span<const uint8_t> header_offsets{};
+    // where the extension records start in the central directory
+    uint64_t extensions_offset{};
+
+    std::pair<uint32_t, uint32_t> GetSlot(size_t slot) const
+    {
+        std::pair<uint32_t, uint32_t> tag_entry;
+        std::memcpy(&tag_entry.first, slots.data() + slot * 8, sizeof(uint32_t));
+        std::memcpy(&tag_entry.second, slots.data() + slot * 8 + 4, sizeof(uint32_t));
+        return tag_entry;
+    }
+
+    uint32_t GetSortedEntry(size_t i) const
+    {
+        uint32_t entry;
+        std::memcpy(&entry, sorted_entries.data() + i * sizeof(entry), sizeof(entry));
+        return entry;
+    }
+
+    uint64_t GetHeaderOffset(size_t entry) const
+    {
+        uint64_t offset;
+        std::memcpy(&offset, header_offsets.data() + entry * sizeof(offset), sizeof(offset));
+        return offset;
+    }
+};
 
 } // namespace
 
@@ -86,15 +181,25 @@ static LocalFileHeader read_local_file_header(std::istream& stream)
 
     Lud::check::in(
         lfh.compression_method,
-        {CompressionMethod::DEFLATE, CompressionMethod::NONE},
+        {CompressionMethod::DEFLATE, CompressionMethod::DEFLATE_CHUNKED, CompressionMethod::DEFLATE_DICTIONARY, CompressionMethod::NONE},
         "Unknown compression method"
     );
 
+    // stored data is copied using the uncompressed size, both have to match
+    Lud::check::that(
+        lfh.compression_method != CompressionMethod::NONE || lfh.compressed_size == lfh.uncompressed_size,
+        "Stored entry sizes do not match"
+    );
+
     return lfh;
 }
 
 static constexpr size_t get_central_directory_header_size(const CentralDirectoryHeader& cdh)
 {
+    if (cdh.signature == Signatures::SOLID_CENTRAL_DIRECTORY_HEADER)
+    {
+        return 36UL + cdh.file_name_length;
+    }
     return 16UL + cdh.file_name_length;
 }
 
@@ -102,6 +207,12 @@ static void write_central_directory_header(std::ostream& stream, const CentralDi
 {
     WRITE_BINARY(stream, cdh.signature);
     WRITE_BINARY(stream, cdh.offset);
+    if (cdh.signature == Signatures::SOLID_CENTRAL_DIRECTORY_HEADER)
+    {
+        WRITE_BINARY(stream, cdh.offset_in_block);
+        WRITE_BINARY(stream, cdh.uncompressed_size);
+        WRITE_BINARY(stream, cdh.CRC_32);
+    }
     WRITE_BINARY(stream, cdh.file_name_length);
 
     if (cdh.file_name_length > 0)
@@ -110,37 +221,183 @@ static void write_central_directory_header(std::ostream& stream, const CentralDi
     }
 }
 
-static CentralDirectoryHeader read_central_directory_header(std::istream& stream)
+static CentralDirectoryHeader read_central_directory_header(_detail_::SpanReader& reader)
 {
     CentralDirectoryHeader cdh;
 
-    READ_BINARY(stream, cdh.signature);
-    READ_BINARY(stream, cdh.offset);
-    READ_BINARY(stream, cdh.file_name_length);
+    reader.Read(cdh.signature);
 
-    if (cdh.file_name_length > 0)
+    Lud::check::in(
+        cdh.signature,
+        {Signatures::CENTRAL_DIRECTORY_HEADER, Signatures::SOLID_CENTRAL_DIRECTORY_HEADER},
+        "Incorrect central directory header signature"
+    );
+
+    reader.Read(cdh.offset);
+    if (cdh.signature == Signatures::SOLID_CENTRAL_DIRECTORY_HEADER)
     {
-        cdh.file_name.resize(cdh.file_name_length);
-        READ_BINARY_PTR(stream, cdh.file_name.data(), cdh.file_name_length);
+        reader.Read(cdh.offset_in_block);
+        reader.Read(cdh.uncompressed_size);
+        reader.Read(cdh.CRC_32);
     }
+    reader.Read(cdh.file_name_length);
 
-    const auto current_pos = stream.tellg();
-    stream.seekg(static_cast<std::streamoff>(cdh.offset), std::ios::beg);
-    uint32_t lfh_signature;
-    READ_BINARY(stream, lfh_signature);
-    stream.seekg(current_pos, std::ios::beg);
+    const auto file_name = reader.ReadBytes(cdh.file_name_length);
+    cdh.file_name.assign(file_name.begin(), file_name.end());
+
+    // the local file header signature is checked when its data is read
+
+    return cdh;
+}
+
+static constexpr size_t get_extension_record_size(const ExtensionRecord& record)
+{
+    return 16UL + record.size;
+}
+
+static void write_extension_record(std::ostream& stream, const ExtensionRecord& record)
+{
+    WRITE_BINARY(stream, record.signature);
+    WRITE_BINARY(stream, record.type);
+    WRITE_BINARY(stream, record.size);
+    WRITE_BINARY_PTR(stream, record.data.data(), record.data.size());
+}
+
+static ExtensionRecord read_extension_record(_detail_::SpanReader& reader)
+{
+    ExtensionRecord record;
+
+    reader.Read(record.signature);
 
     Lud::check::that(
-        cdh.signature == Signatures::CENTRAL_DIRECTORY_HEADER,
-        "Incorrect central directory header signature"
+        record.signature == Signatures::EXTENSION_RECORD,
+        "Incorrect extension record signature"
     );
 
+    reader.Read(record.type);
+    reader.Read(record.size);
+    record.data = reader.ReadBytes(record.size);
+
+    return record;
+}
+
+// FNV-1a, it is part of the format so it can not change between builds like std::hash
+static constexpr uint64_t hash_name(const std::string_view name)
+{
+    uint64_t hash = 0xCBF29CE484222325;
+    for (const char c : name)
+    {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001B3;
+    }
+    return hash;
+}
+
+static std::vector<uint8_t> make_name_index(std::span<const std::string_view> names, std::span<const uint64_t> header_offsets, uint64_t extensions_offset)
+{
+    // at most half full, so a lookup probes few slots
+    const auto slot_count = static_cast<uint32_t>(std::bit_ceil(std::max<size_t>(names.size() * 2, 1)));
+    const auto entry_count = static_cast<uint32_t>(names.size());
+
+    std::vector<uint32_t> slots(size_t{slot_count} * 2);
+    for (uint32_t i = 0; i < entry_count; i++)
+    {
+        const uint64_t hash = hash_name(names[i]);
+        const auto tag = static_cast<uint32_t>(hash >> 32);
+        for (size_t slot = hash & (slot_count - 1);; slot = (slot + 1) & (slot_count - 1))
+        {
+            const uint32_t entry = slots[slot * 2 + 1];
+            // the last entry with a name is the one found, like with the in memory index
+            if (entry == 0 || (slots[slot * 2] == tag && names[entry - 1] == names[i]))
+            {
+                slots[slot * 2] = tag;
+                slots[slot * 2 + 1] = i + 1;
+                break;
+            }
+        }
+    }
+
+    std::vector<uint32_t> sorted_entries(entry_count);
+    std::iota(sorted_entries.begin(), sorted_entries.end(), 0);
+    std::ranges::stable_sort(sorted_entries, {}, [&](uint32_t i) { return names[i]; });
+
+    const size_t slots_size = slots.size() * sizeof(uint32_t);
+    const size_t sorted_entries_size = sorted_entries.size() * sizeof(uint32_t);
+    const size_t header_offsets_size = header_offsets.size() * sizeof(uint64_t);
+
+    std::vector<uint8_t> data(8 + slots_size + sorted_entries_size + header_offsets_size + sizeof(extensions_offset));
+    auto* out = data.data();
+    std::memcpy(out, &slot_count, sizeof(slot_count));
+    std::memcpy(out + 4, &entry_count, sizeof(entry_count));
+    out += 8;
+    std::memcpy(out, slots.data(), slots_size);
+    out += slots_size;
+    std::memcpy(out, sorted_entries.data(), sorted_entries_size);
+    out += sorted_entries_size;
+    std::memcpy(out, header_offsets.data(), header_offsets_size);
+    out += header_offsets_size;
+    // last in the central directory, so readers find the index without going through the headers
+    std::memcpy(out, &extensions_offset, sizeof(extensions_offset));
+
+    return data;
+}
+
+static NameIndexTable read_name_index(std::span<const uint8_t> data, uint32_t directory_record_number, uint64_t extensions_offset)
+{
+    _detail_::SpanReader reader(data);
+    NameIndexTable table;
+
+    reader.Read(table.slot_count);
+    reader.Read(table.entry_count);
     Lud::check::that(
-        lfh_signature == Signatures::LOCAL_FILE_HEADER,
-        "central directory header offset does not point to local file header"
-    );
+        std::has_single_bit(table.slot_count) && table.slot_count > table.entry_count && table.entry_count == directory_record_number,
+        "Name index does not match the central directory");
 
-    return cdh;
+    table.slots = reader.ReadBytes(size_t{table.slot_count} * 8);
+    table.sorted_entries = reader.ReadBytes(size_t{table.entry_count} * sizeof(uint32_t));
+    table.header_offsets = reader.ReadBytes(size_t{table.entry_count} * sizeof(uint64_t));
+    reader.Read(table.extensions_offset);
+    Lud::check::that(table.extensions_offset == extensions_offset, "Name index does not match the central directory");
+
+    return table;
+}
+
+// where the extension records start if the central directory ends with a name index, which says so
+// in its last 8 bytes, the headers are not read, nothing is found for archives without an index
+static std::optional<uint64_t> find_extension_records(std::span<const uint8_t> central_directory)
+{
+    constexpr size_t record_header_size = 16;
+    uint64_t extensions_offset;
+    if (central_directory.size() < record_header_size + sizeof(extensions_offset))
+    {
+        return std::nullopt;
+    }
+    std::memcpy(&extensions_offset, central_directory.data() + central_directory.size() - sizeof(extensions_offset), sizeof(extensions_offset));
+
+    // those 8 bytes are anything if there is no index, so the records have to end right at the end of the directory
+    uint64_t offset = extensions_offset;
+    uint32_t type = 0;
+    while (offset < central_directory.size())
+    {
+        if (central_directory.size() - offset < record_header_size)
+        {
+            return std::nullopt;
+        }
+        uint32_t signature;
+        uint64_t size;
+        std::memcpy(&signature, central_directory.data() + offset, sizeof(signature));
+        std::memcpy(&type, central_directory.data() + offset + 4, sizeof(type));
+        std::memcpy(&size, central_directory.data() + offset + 8, sizeof(size));
+        if (signature != Signatures::EXTENSION_RECORD || size > central_directory.size() - offset - record_header_size)
+        {
+            return std::nullopt;
+        }
+        offset += record_header_size + size;
+    }
+    if (offset != central_directory.size() || type != ExtensionType::NAME_INDEX)
+    {
+        return std::nullopt;
+    }
+    return extensions_offset;
 }
 
 static constexpr size_t get_end_of_central_directory_record_size()
@@ -166,23 +423,11 @@ static EndOfCentralDirectoryRecord read_end_of_central_directory_record(std::ist
     READ_BINARY(stream, eocd.directory_record_number);
     READ_BINARY(stream, eocd.offset);
 
-    // further validation
-    const auto current_pos = stream.tellg();
-    stream.seekg(static_cast<std::streamoff>(eocd.offset), std::ios::beg);
-    uint32_t cdh_signature;
-    READ_BINARY(stream, cdh_signature);
-    stream.seekg(current_pos, std::ios::beg);
-
     Lud::check::that(
         eocd.signature == Signatures::END_OF_CENTRAL_DIRECTORY_RECORD,
         "Incorrect EOCD signature"
     );
 
-    Lud::check::that(
-        cdh_signature == Signatures::CENTRAL_DIRECTORY_HEADER,
-        "EOCD offset does not point to central directory header"
-    );
-
     Lud::check::that(
         begin_size - eocd.offset == eocd.central_directory_size,
         "Incorrect EOCD directory size"
@@ -191,6 +436,87 @@ static EndOfCentralDirectoryRecord read_end_of_central_directory_record(std::ist
     return eocd;
 }
 
+static constexpr size_t get_chunk_table_size(size_t chunk_count)
+{
+    return 8UL + 8UL * chunk_count;
+}
+
+static ChunkTable read_chunk_table(std::span<const uint8_t> compressed_data, uint64_t uncompressed_size)
+{
+    _detail_::SpanReader reader(compressed_data);
+
+    ChunkTable table;
+    reader.Read(table.chunk_size);
+    reader.Read(table.chunk_count);
+
+    Lud::check::that(
+        table.chunk_size > 0 && table.chunk_count == (uncompressed_size + table.chunk_size - 1) / table.chunk_size,
+        "Incorrect chunk table"
+    );
+
+    table.chunk_ends = reader.ReadBytes(8UL * table.chunk_count);
+    table.data = reader.ReadBytes(reader.GetRemaining());
+
+    uint64_t previous_end = 0;
+    for (size_t i = 0; i < table.chunk_count; i++)
+    {
+        const uint64_t end = table.GetChunkEnd(i);
+        Lud::check::that(end >= previous_end && end <= table.data.size(), "Incorrect chunk table");
+        previous_end = end;
+    }
+
+    return table;
+}
+
+/**
+ * chunks are deflated on their own and end byte aligned, so the concatenation of all of them is still
+ * a single valid deflate stream, but any chunk can be inflated without inflating the ones before it
+ *
+ * returns an empty vector if the data did not get smaller
+ */
+static std::vector<uint8_t> deflate_chunked(std::span<const uint8_t> data, int level, uint32_t chunk_size, unsigned int threads)
+{
+    const size_t chunk_count = (data.size() + chunk_size - 1) / chunk_size;
+    std::vector<std::vector<uint8_t>> chunks(chunk_count);
+
+    _detail_::parallel_for(chunk_count, threads, [&](size_t i) {
+        const auto chunk = data.subspan(i * chunk_size, std::min<size_t>(chunk_size, data.size() - i * chunk_size));
+        _detail_::deflate_raw_chunk(chunk, level, i + 1 == chunk_count, chunks[i]);
+    });
+
+    size_t compressed_size = get_chunk_table_size(chunk_count);
+    for (const auto& chunk : chunks)
+    {
+        compressed_size += chunk.size();
+    }
+    if (compressed_size >= data.size())
+    {
+        return {};
+    }
+
+    std::vector<uint8_t> compressed_data;
+    compressed_data.reserve(compressed_size);
+    const auto append = [&](const auto& value) {
+        const auto* bytes = reinterpret_cast<const uint8_t*>(&value);
+        compressed_data.insert(compressed_data.end(), bytes, bytes + sizeof(value));
+    };
+
+    append(chunk_size);
+    append(static_cast<uint32_t>(chunk_count));
+    uint64_t end = 0;
+    for (const auto& chunk : chunks)
+    {
+        end += chunk.size();
+        append(end);
+    }
+    for (const auto& chunk : chunks)
+    {
+        compressed_data.insert(compressed_data.end(), chunk.begin(), chunk.end());
+    }
+
+    return compressed_data;
+}
+
 static std::vector<uint8_t> slurp(std::istream& stream)
 {
     const auto current_pos = stream.tellg();
@@ -204,222 +530,1234 @@ static std::vector<uint8_t> slurp(std::istream& stream)
 
 struct RezipArchive::Impl
 {
+    // many small entries compressed together, its header describes the whole block
+    struct solid_block
+    {
+        LocalFileHeader header;
+        std::vector<uint8_t> compressed_data;
+        // offset of the data in the source
+        uint64_t offset{0};
+        // false if compressed_data has to be read from the source
+        bool loaded{true};
+    };
     struct file_entry
     {
         LocalFileHeader header;
         std::string name;
         std::vector<uint8_t> compressed_data;
+        // only for entries in a solid block, which holds their data instead of compressed_data
+        std::shared_ptr<const solid_block> block{};
+        uint64_t offset_in_block{0};
+        // offset of the data in the source
+        uint64_t offset{0};
+        // false if compressed_data has to be read from the source
+        bool loaded{true};
     };
-    std::vector<file_entry> file_entries;
-};
+    // slots do not move when entries are added or removed, the name index views their names
+    _detail_::SlotMap<file_entry> file_entries;
+    _detail_::NameIndex name_index;
+
+    CompressionPolicy compression_policy;
+    // 0 if entries are not chunked
+    uint32_t chunk_size{0};
+    // empty if there is no preset dictionary
+    std::vector<uint8_t> dictionary;
+    // 0 if entries are not written in solid blocks
+    uint32_t solid_block_size{0};
+    // 0 or 1 if stored entries are not aligned
+    uint32_t stored_alignment{0};
+    bool write_name_index{false};
+
+    // the name index of the archive that was read, Find uses it instead of name_index
+    // until entries are added or removed, entry numbers are slot indices until then
+    NameIndexTable disk_name_index;
+    // the central directory the index views, empty if it views source_data
+    std::vector<uint8_t> directory_data;
+    std::span<const uint8_t> directory;
+
+    bool has_disk_name_index() const
+    {
+        return disk_name_index.slot_count > 0;
+    }
 
-RezipArchive::RezipArchive()
-    : p_impl(new Impl)
-{
-}
+    // indexes every name in memory, the index that was read is no longer used
+    void build_name_index();
+
+    std::optional<size_t> find_in_disk_name_index(const std::string_view name) const;
+
+    // archives read lazily with a name index do not parse their headers on construction,
+    // an entry is parsed from the directory the first time it is used, until read_directory
+    // moves every one of them to file_entries
+    bool directory_read{true};
+    mutable std::mutex unread_mutex;
+    mutable std::unordered_map<size_t, file_entry> unread_entries;
+    mutable std::unordered_map<uint64_t, std::shared_ptr<const solid_block>> unread_blocks;
+
+    // makes the entry of a central directory header, blocks keeps the solid blocks already read
+    // so their entries share them, read_data reads a local file header and data at an offset
+    template <typename ReadData>
+    static file_entry make_read_entry(CentralDirectoryHeader&& cdh, std::unordered_map<uint64_t, std::shared_ptr<const solid_block>>& blocks, bool loaded, ReadData&& read_data);
+
+    // parses every unread entry, so entries can be added and removed
+    void read_directory();
+
+    // same as their SlotMap counterparts, also for unread entries
+    size_t get_slot_count() const;
+    bool is_alive(size_t index) const;
+    uint32_t get_generation(size_t index) const;
+    const file_entry& get_entry(size_t index) const;
+
+    // the last solid block inflated, reading the entries of a block in order inflates it once
+    mutable std::mutex block_cache_mutex;
+    mutable std::weak_ptr<const solid_block> cached_block;
+    mutable std::shared_ptr<const std::vector<uint8_t>> cached_block_data;
+
+    std::shared_ptr<const std::vector<uint8_t>> get_block_data(const std::shared_ptr<const solid_block>& block) const;
+
+    // only set for archives read lazily from a stream
+    std::istream* source{nullptr};
+    mutable std::mutex source_mutex;
+    // only set for archives read lazily from memory, entries are viewed in place
+    std::span<const uint8_t> source_data;
+    // only set for archives read from a file on disk, source_data views it
+    std::unique_ptr<_detail_::MappedFile> mapping;
+
+    // reads size bytes at offset of the source, into buffer if the source is a stream
+    std::span<const uint8_t> read_source(uint64_t offset, uint64_t size, std::vector<uint8_t>& buffer) const;
+
+    // the compressed data of an entry or a block, read from the source if it was not loaded
+    template <typename T>
+    std::span<const uint8_t> get_compressed_data(const T& entry, std::vector<uint8_t>& buffer) const
+    {
+        if (entry.loaded)
+        {
+            return entry.compressed_data;
+        }
+        return read_source(entry.offset, entry.header.compressed_size, buffer);
+    }
 
-RezipArchive::RezipArchive(std::istream& stream)
-    : RezipArchive()
-{
-    read(stream);
-}
+    static file_entry make_entry(const std::string_view name, std::span<const uint8_t> uncompressed_data, const CompressionPolicy& policy, uint32_t chunk_size, std::span<const uint8_t> dictionary, unsigned int threads);
 
-RezipArchive::~RezipArchive()
-{
-    delete p_impl;
-}
+    static file_entry make_raw_entry(const std::string_view name, RawArchiveEntry&& raw);
 
-void RezipArchive::Push(const std::string_view name, std::istream& stream)
-{
-    auto uncompressed_data = slurp(stream);
+    void add_entry(file_entry&& entry);
 
-    p_impl->file_entries.emplace_back();
+    file_entry remove_entry(const ArchiveEntry& entry);
 
-    auto& [lfh, file_name, compressed_data] = p_impl->file_entries.back();
+    const file_entry& get_entry(const ArchiveEntry& entry) const;
 
-    // TODO: implement crc32
-    uint32_t crc = 0; // crc32(0, uncompressed_data.data(), uncompressed_data.size());
+    ArchiveEntry make_archive_entry(size_t index) const;
 
-    if (!uncompressed_data.empty())
-    {
-        // zlib recommends to set the buffer size to at least the uncompressed size
-        compressed_data.reserve(uncompressed_data.size());
+    std::span<uint8_t> decompress(const file_entry& entry, std::span<uint8_t> output) const;
 
-        // scoped so sync is automatically called on destruction
-        {
-            Lud::vector_ostream vec_ostream(compressed_data);
-            Lud::deflate_ostream comp_ostream(vec_ostream, {.type = Lud::CompressionType::RAW});
+    // the deflate stream of deflated entries, without the chunk table of chunked ones
+    std::span<const uint8_t> get_deflate_stream(const file_entry& entry, std::vector<uint8_t>& buffer) const;
+};
 
-            WRITE_BINARY_PTR(comp_ostream, uncompressed_data.data(), uncompressed_data.size());
-        }
-        if (compressed_data.size() >= uncompressed_data.size())
+RezipArchive::Impl::file_entry RezipArchive::Impl::make_entry(const std::string_view name, std::span<const uint8_t> uncompressed_data, const CompressionPolicy& policy, uint32_t chunk_size, std::span<const uint8_t> dictionary, unsigned int threads)
+{
+    RawArchiveEntry raw{
+        .compressed_data = {},
+        .compression = archive_compression::none,
+        .crc = _detail_::crc32(uncompressed_data),
+        .uncompressed_size = uncompressed_data.size(),
+    };
+
+    const bool deflate = _detail_::choose_compression(name, uncompressed_data, policy) == archive_compression::deflate;
+    const bool chunked = chunk_size > 0 && uncompressed_data.size() > chunk_size
+                      && uncompressed_data.size() / chunk_size < std::numeric_limits<uint32_t>::max();
+    if (deflate && chunked)
+    {
+        raw.compressed_data = deflate_chunked(uncompressed_data, policy.level, chunk_size, threads);
+        if (!raw.compressed_data.empty())
         {
-            compressed_data = std::move(uncompressed_data);
-            lfh.compression_method = CompressionMethod::NONE;
-            lfh.uncompressed_size = compressed_data.size();
-            lfh.compressed_size = compressed_data.size();
+            raw.compression = archive_compression::deflate;
+            auto entry = make_raw_entry(name, std::move(raw));
+            entry.header.compression_method = CompressionMethod::DEFLATE_CHUNKED;
+            return entry;
         }
-        else
+        raw.compressed_data.assign(uncompressed_data.begin(), uncompressed_data.end());
+    }
+    else if (deflate && !dictionary.empty())
+    {
+        if (_detail_::deflate_raw(uncompressed_data, policy.level, raw.compressed_data, dictionary))
         {
-            lfh.compression_method = CompressionMethod::DEFLATE;
-            lfh.compressed_size = compressed_data.size();
-            lfh.uncompressed_size = uncompressed_data.size();
+            raw.compression = archive_compression::deflate;
+            auto entry = make_raw_entry(name, std::move(raw));
+            entry.header.compression_method = CompressionMethod::DEFLATE_DICTIONARY;
+            return entry;
         }
+        raw.compressed_data.assign(uncompressed_data.begin(), uncompressed_data.end());
+    }
+    else if (deflate && _detail_::deflate_raw(uncompressed_data, policy.level, raw.compressed_data))
+    {
+        raw.compression = archive_compression::deflate;
     }
     else
     {
-        lfh.compression_method = CompressionMethod::NONE;
-        lfh.uncompressed_size = compressed_data.size();
-        lfh.compressed_size = compressed_data.size();
+        raw.compressed_data.assign(uncompressed_data.begin(), uncompressed_data.end());
     }
 
-    lfh.signature = Signatures::LOCAL_FILE_HEADER;
-    lfh.CRC_32 = crc;
-    file_name = name;
+    return make_raw_entry(name, std::move(raw));
 }
 
-std::vector<ArchiveEntry> RezipArchive::GetDirectory() const
+RezipArchive::Impl::file_entry RezipArchive::Impl::make_raw_entry(const std::string_view name, RawArchiveEntry&& raw)
 {
-    std::vector<ArchiveEntry> directory;
+    Lud::check::in(
+        raw.compression,
+        {archive_compression::deflate, archive_compression::none},
+        "Unknown compression method"
+    );
+    Lud::check::that(
+        raw.compression != archive_compression::none || raw.compressed_data.size() == raw.uncompressed_size,
+        "Stored entry sizes do not match"
+    );
 
-    const auto& entries = p_impl->file_entries;
+    file_entry entry;
+    auto& lfh = entry.header;
 
-    directory.reserve(entries.size());
-    for (size_t i = 0; i < entries.size(); i++)
+    lfh.signature = Signatures::LOCAL_FILE_HEADER;
+    lfh.CRC_32 = raw.crc;
+    lfh.compression_method = raw.compression == archive_compression::deflate ? CompressionMethod::DEFLATE : CompressionMethod::NONE;
+    lfh.compressed_size = raw.compressed_data.size();
+    lfh.uncompressed_size = raw.uncompressed_size;
+    entry.name = name;
+    entry.compressed_data = std::move(raw.compressed_data);
+
+    return entry;
+}
+
+void RezipArchive::Impl::build_name_index()
+{
+    disk_name_index = {};
+    directory_data.clear();
+    directory = {};
+
+    name_index.Clear();
+    for (size_t i = 0; i < file_entries.GetSlotCount(); i++)
     {
-        directory.emplace_back(
-            entries[i].name,
-            i,
-            static_cast<uint32_t>(entries[i].header.uncompressed_size),
-            static_cast<uint32_t>(entries[i].header.compressed_size)
-        );
+        if (file_entries.IsAlive(i))
+        {
+            name_index.Insert(file_entries[i].name, i);
+        }
     }
-    return directory;
 }
 
-void RezipArchive::Write(std::ostream& stream) const
+template <typename ReadData>
+RezipArchive::Impl::file_entry RezipArchive::Impl::make_read_entry(CentralDirectoryHeader&& cdh, std::unordered_map<uint64_t, std::shared_ptr<const solid_block>>& blocks, bool loaded, ReadData&& read_data)
 {
-    const auto& file_entries = p_impl->file_entries;
+    if (cdh.signature == Signatures::SOLID_CENTRAL_DIRECTORY_HEADER)
+    {
+        auto& block = blocks[cdh.offset];
+        if (!block)
+        {
+            auto [lfh, compressed_data, data_offset] = read_data(cdh.offset);
+            Lud::check::in(lfh.compression_method, {CompressionMethod::DEFLATE, CompressionMethod::NONE}, "Unknown solid block compression method");
+            block = std::make_shared<const solid_block>(lfh, std::move(compressed_data), data_offset, loaded);
+        }
 
-    std::vector<CentralDirectoryHeader> central_directory;
-    central_directory.reserve(file_entries.size());
+        return {
+            .header = {
+                .compressed_size = 0,
+                .uncompressed_size = cdh.uncompressed_size,
+                .signature = Signatures::LOCAL_FILE_HEADER,
+                .CRC_32 = cdh.CRC_32,
+                .compression_method = CompressionMethod::SOLID,
+            },
+            .name = std::move(cdh.file_name),
+            .compressed_data = {},
+            .block = block,
+            .offset_in_block = cdh.offset_in_block,
+        };
+    }
 
-    uint64_t total_written = 0;
-    uint64_t central_directory_size = 0;
+    auto [lfh, compressed_data, data_offset] = read_data(cdh.offset);
+    return {
+        .header = lfh,
+        .name = std::move(cdh.file_name),
+        .compressed_data = std::move(compressed_data),
+        .offset = data_offset,
+        .loaded = loaded,
+    };
+}
 
-    for (const auto& entry : file_entries)
+void RezipArchive::Impl::read_directory()
+{
+    if (directory_read)
     {
-        central_directory.emplace_back(
-            entry.name,
-            total_written,
-            Signatures::CENTRAL_DIRECTORY_HEADER,
-            static_cast<uint32_t>(entry.name.size())
-        );
-
-        write_local_file_header(stream, entry.header);
-        WRITE_BINARY_PTR(stream, entry.compressed_data.data(), entry.compressed_data.size());
-
-        total_written += get_local_file_header_size() + entry.header.compressed_size;
-        central_directory_size += get_central_directory_header_size(central_directory.back());
+        return;
     }
-    for (const auto& directory : central_directory)
+
+    for (size_t i = 0; i < disk_name_index.entry_count; i++)
     {
-        write_central_directory_header(stream, directory);
+        get_entry(i);
+        file_entries.Insert(std::move(unread_entries.at(i)));
     }
+    unread_entries.clear();
+    unread_blocks.clear();
+    directory_read = true;
+}
 
-    EndOfCentralDirectoryRecord eocd{
-        .offset = total_written,
-        .central_directory_size = central_directory_size,
-        .signature = Signatures::END_OF_CENTRAL_DIRECTORY_RECORD,
-        .directory_record_number = static_cast<uint32_t>(central_directory.size()),
-    };
+size_t RezipArchive::Impl::get_slot_count() const
+{
+    return directory_read ? file_entries.GetSlotCount() : disk_name_index.entry_count;
+}
 
-    write_end_of_central_directory_record(stream, eocd);
+bool RezipArchive::Impl::is_alive(size_t index) const
+{
+    return directory_read ? file_entries.IsAlive(index) : index < disk_name_index.entry_count;
 }
 
-std::vector<uint8_t> RezipArchive::Peek(const ArchiveEntry& entry) const
+uint32_t RezipArchive::Impl::get_generation(size_t index) const
 {
-    auto& entries = p_impl->file_entries;
+    // unread entries were never removed
+    return directory_read ? file_entries.GetGeneration(index) : 0;
+}
 
-    auto& [lfh, _, compressed_data] = entries[entry.index];
-    std::vector<uint8_t> uncompressed_data;
-    uncompressed_data.resize(lfh.uncompressed_size);
-    if (lfh.compression_method == CompressionMethod::NONE)
+const RezipArchive::Impl::file_entry& RezipArchive::Impl::get_entry(size_t index) const
+{
+    if (directory_read)
     {
-        std::copy_n(compressed_data.begin(), lfh.uncompressed_size, uncompressed_data.begin());
+        return file_entries[index];
     }
-    else
-    {
-        Lud::memory_istream<uint8_t> mem_stream(compressed_data);
-        Lud::inflate_istream inflate_stream(mem_stream, {.type = Lud::CompressionType::RAW});
 
-        READ_BINARY_PTR(inflate_stream, uncompressed_data.data(), uncompressed_data.size());
+    std::scoped_lock lock(unread_mutex);
+    // nodes do not move, so the entry stays where it is while others are parsed
+    if (const auto it = unread_entries.find(index); it != unread_entries.end())
+    {
+        return it->second;
     }
 
-    // Lud::check::eq(
-    //     lfh.CRC_32,
-    //     crc32(0, uncompressed_data.data(), lfh.uncompressed_size),
-    //     std::format("File: [{}] is corrupted and can not be recovered", lfh.file_name));
+    const uint64_t header_offset = disk_name_index.GetHeaderOffset(index);
+    Lud::check::that(header_offset < disk_name_index.extensions_offset, "Name index does not match the central directory");
+    _detail_::SpanReader reader(directory.subspan(header_offset, disk_name_index.extensions_offset - header_offset));
 
-    return uncompressed_data;
+    std::vector<uint8_t> buffer;
+    auto entry = make_read_entry(read_central_directory_header(reader), unread_blocks, false, [&](uint64_t offset) {
+        const auto header_data = read_source(offset, get_local_file_header_size(), buffer);
+        Lud::memory_istream<uint8_t> stream(header_data);
+        return std::tuple{read_local_file_header(stream), std::vector<uint8_t>{}, offset + get_local_file_header_size()};
+    });
+
+    return unread_entries.emplace(index, std::move(entry)).first->second;
 }
 
-std::vector<uint8_t> RezipArchive::Pop(const ArchiveEntry& entry)
+std::optional<size_t> RezipArchive::Impl::find_in_disk_name_index(const std::string_view name) const
 {
-    auto& file_entries = p_impl->file_entries;
+    const uint64_t hash = hash_name(name);
+    const auto tag = static_cast<uint32_t>(hash >> 32);
+    const uint32_t mask = disk_name_index.slot_count - 1;
 
-    auto& file_entry_to_remove = file_entries[entry.index];
-
-    file_entries.erase(file_entries.begin() + static_cast<ptrdiff_t>(entry.index));
-
-    const auto& [lfh, name, compressed_data] = file_entry_to_remove;
-    std::vector<uint8_t> uncompressed_data;
-    uncompressed_data.resize(lfh.uncompressed_size);
-    if (lfh.compression_method == CompressionMethod::NONE)
+    size_t slot = hash & mask;
+    for (uint32_t probes = 0; probes < disk_name_index.slot_count; probes++, slot = (slot + 1) & mask)
     {
-        std::copy_n(compressed_data.begin(), lfh.uncompressed_size, uncompressed_data.begin());
+        const auto [slot_tag, entry] = disk_name_index.GetSlot(slot);
+        if (entry == 0)
+        {
+            break;
+        }
+        if (slot_tag == tag && entry <= disk_name_index.entry_count && get_entry(entry - 1).name == name)
+        {
+            return entry - 1;
+        }
     }
-    else
-    {
-        Lud::memory_istream<uint8_t> mem_stream(compressed_data);
-        Lud::inflate_istream inflate_stream(mem_stream, {.type = Lud::CompressionType::RAW});
+    return std::nullopt;
+}
 
-        READ_BINARY_PTR(inflate_stream, uncompressed_data.data(), uncompressed_data.size());
+void RezipArchive::Impl::add_entry(file_entry&& entry)
+{
+    if (has_disk_name_index())
+    {
+        read_directory();
+        build_name_index();
     }
-
-    return uncompressed_data;
+    const size_t index = file_entries.Insert(std::move(entry));
+    name_index.Insert(file_entries[index].name, index);
 }
 
-void RezipArchive::read(std::istream& stream)
+RezipArchive::Impl::file_entry RezipArchive::Impl::remove_entry(const ArchiveEntry& entry)
 {
-    constexpr auto eocd_size = static_cast<std::streamoff>(get_end_of_central_directory_record_size());
-
-    stream.seekg(-eocd_size, std::ios::end);
+    if (has_disk_name_index())
+    {
+        read_directory();
+        build_name_index();
+    }
+    Lud::check::that(file_entries.Contains(entry.index, entry.generation), "Entry is not in the archive");
+    auto& file_entry = file_entries[entry.index];
 
-    auto eocd = read_end_of_central_directory_record(stream);
+    // erased before the entry is moved, the key views its name
+    name_index.Erase(file_entry.name, entry.index);
+    auto removed = std::move(file_entry);
+    file_entries.Erase(entry.index);
 
-    std::vector<CentralDirectoryHeader> central_directory(eocd.directory_record_number);
+    return removed;
+}
 
-    stream.seekg(static_cast<std::streamoff>(eocd.offset), std::ios::beg);
+const RezipArchive::Impl::file_entry& RezipArchive::Impl::get_entry(const ArchiveEntry& entry) const
+{
+    Lud::check::that(is_alive(entry.index) && get_generation(entry.index) == entry.generation, "Entry is not in the archive");
 
-    auto& entries = p_impl->file_entries;
+    return get_entry(entry.index);
+}
 
-    for (size_t i = 0; i < eocd.directory_record_number; i++)
-    {
-        auto cdh = read_central_directory_header(stream);
-        const auto current_pos = stream.tellg();
-        stream.seekg(static_cast<std::streamoff>(cdh.offset));
+ArchiveEntry RezipArchive::Impl::make_archive_entry(size_t index) const
+{
+    const auto& entry = get_entry(index);
+    return {
+        entry.name,
+        index,
+        get_generation(index),
+        entry.header.uncompressed_size,
+        entry.header.compressed_size,
+    };
+}
 
-        auto lfh = read_local_file_header(stream);
-        std::vector<uint8_t> compressed_data(lfh.compressed_size);
-        READ_BINARY_PTR(stream, compressed_data.data(), compressed_data.size());
-        stream.seekg(current_pos);
-
-        entries.emplace_back(
-            lfh,
-            std::move(cdh.file_name),
-            std::move(compressed_data)
+std::span<uint8_t> RezipArchive::Impl::decompress(const file_entry& entry, std::span<uint8_t> output) const
+{
+    const auto& lfh = entry.header;
+    const auto& name = entry.name;
+    Lud::check::that(
+        output.size() >= lfh.uncompressed_size,
+        std::format("File: [{}] does not fit in the output", name));
+
+    const auto uncompressed_data = output.first(lfh.uncompressed_size);
+    std::vector<uint8_t> buffer;
+    if (lfh.compression_method == CompressionMethod::NONE)
+    {
+        std::copy_n(get_compressed_data(entry, buffer).begin(), lfh.uncompressed_size, uncompressed_data.begin());
+    }
+    else if (lfh.compression_method == CompressionMethod::SOLID)
+    {
+        const auto& offset_in_block = entry.offset_in_block;
+        const auto block_data = get_block_data(entry.block);
+        Lud::check::that(
+            offset_in_block <= block_data->size() && lfh.uncompressed_size <= block_data->size() - offset_in_block,
+            std::format("File: [{}] is corrupted and can not be recovered", name));
+        std::copy_n(block_data->begin() + static_cast<std::ptrdiff_t>(offset_in_block), lfh.uncompressed_size, uncompressed_data.begin());
+    }
+    else if (lfh.compression_method == CompressionMethod::DEFLATE_CHUNKED)
+    {
+        const auto table = read_chunk_table(get_compressed_data(entry, buffer), lfh.uncompressed_size);
+        // inflated serially, this runs inside the workers of ExtractAll and PushMany
+        // so a pool here would start threads for every entry of every worker
+        for (size_t i = 0; i < table.chunk_count; i++)
+        {
+            const auto chunk = uncompressed_data.subspan(i * table.chunk_size).first(std::min<uint64_t>(table.chunk_size, lfh.uncompressed_size - i * table.chunk_size));
+            Lud::check::that(
+                _detail_::inflate_raw(table.GetChunk(i), chunk, i + 1 == table.chunk_count),
+                std::format("File: [{}] is corrupted and can not be recovered", name));
+        }
+    }
+    else
+    {
+        const bool uses_dictionary = lfh.compression_method == CompressionMethod::DEFLATE_DICTIONARY;
+        Lud::check::that(
+            _detail_::inflate_raw(get_compressed_data(entry, buffer), uncompressed_data, true, uses_dictionary ? dictionary : std::span<const uint8_t>{}),
+            std::format("File: [{}] is corrupted and can not be recovered", name));
+    }
+
+#ifdef VARF_DO_CRC_32
+    Lud::check::eq(
+        lfh.CRC_32,
+        _detail_::crc32(uncompressed_data),
+        std::format("File: [{}] is corrupted and can not be recovered", name));
+#endif
+
+    return uncompressed_data;
+}
+
+std::shared_ptr<const std::vector<uint8_t>> RezipArchive::Impl::get_block_data(const std::shared_ptr<const solid_block>& block) const
+{
+    {
+        std::scoped_lock lock(block_cache_mutex);
+        if (cached_block.lock() == block)
+        {
+            return cached_block_data;
+        }
+    }
+
+    // inflated without holding the lock, other threads might be reading other blocks
+    const auto& header = block->header;
+    std::vector<uint8_t> buffer;
+    const auto compressed_data = get_compressed_data(*block, buffer);
+    auto data = std::make_shared<std::vector<uint8_t>>(header.uncompressed_size);
+    if (header.compression_method == CompressionMethod::NONE)
+    {
+        std::copy_n(compressed_data.begin(), header.uncompressed_size, data->begin());
+    }
+    else
+    {
+        Lud::check::that(_detail_::inflate_raw(compressed_data, *data), "Solid block is corrupted and can not be recovered");
+    }
+
+    std::scoped_lock lock(block_cache_mutex);
+    cached_block = block;
+    cached_block_data = data;
+
+    return data;
+}
+
+std::span<const uint8_t> RezipArchive::Impl::read_source(uint64_t offset, uint64_t size, std::vector<uint8_t>& buffer) const
+{
+    if (source == nullptr)
+    {
+        Lud::check::that(
+            offset <= source_data.size() && size <= source_data.size() - offset,
+            "Could not read entry data");
+        const auto data = source_data.subspan(offset, size);
+        if (mapping && data.size() >= _detail_::STREAM_WINDOW_SIZE)
+        {
+            mapping->WillNeed(data);
+        }
+        return data;
+    }
+
+    // the buffer only grows, so reusing it for many entries does not allocate every time
+    if (buffer.size() < size)
+    {
+        buffer.resize(size);
+    }
+    const auto data = std::span(buffer).first(size);
+
+    std::scoped_lock lock(source_mutex);
+    source->clear();
+    source->seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+    READ_BINARY_PTR((*source), data.data(), data.size());
+    Lud::check::that(source->good(), "Could not read entry data");
+
+    return data;
+}
+
+std::span<const uint8_t> RezipArchive::Impl::get_deflate_stream(const file_entry& entry, std::vector<uint8_t>& buffer) const
+{
+    const auto compressed_data = get_compressed_data(entry, buffer);
+    if (entry.header.compression_method == CompressionMethod::DEFLATE_CHUNKED)
+    {
+        return read_chunk_table(compressed_data, entry.header.uncompressed_size).data;
+    }
+    return compressed_data;
+}
+
+RezipArchive::RezipArchive()
+    : p_impl(new Impl)
+{
+}
+
+RezipArchive::RezipArchive(std::istream& stream, ArchiveMode mode)
+    : RezipArchive()
+{
+    read(stream, mode);
+
+    if (mode & archive_mode::lazy)
+    {
+        p_impl->source = &stream;
+    }
+}
+
+RezipArchive::RezipArchive(std::span<const uint8_t> data)
+    : RezipArchive()
+{
+    p_impl->source_data = data;
+
+    Lud::memory_istream<uint8_t> stream(data);
+    read(stream, archive_mode::lazy);
+}
+
+RezipArchive::RezipArchive(const std::filesystem::path& path)
+    : RezipArchive()
+{
+    p_impl->mapping = std::make_unique<_detail_::MappedFile>(path);
+    p_impl->source_data = p_impl->mapping->GetData();
+
+    Lud::memory_istream<uint8_t> stream(p_impl->source_data);
+    read(stream, archive_mode::lazy);
+}
+
+RezipArchive::~RezipArchive()
+{
+    delete p_impl;
+}
+
+void RezipArchive::Push(const std::string_view name, std::istream& stream)
+{
+    p_impl->add_entry(Impl::make_entry(name, slurp(stream), p_impl->compression_policy, p_impl->chunk_size, p_impl->dictionary, 0));
+}
+
+void RezipArchive::PushMany(std::span<const ArchiveInput> inputs, unsigned int threads)
+{
+    std::vector<Impl::file_entry> entries(inputs.size());
+
+    _detail_::parallel_for(inputs.size(), threads, [&](size_t i) {
+        const auto& [name, data] = inputs[i];
+        if (const auto* stream = std::get_if<std::istream*>(&data))
+        {
+            entries[i] = Impl::make_entry(name, slurp(**stream), p_impl->compression_policy, p_impl->chunk_size, p_impl->dictionary, 1);
+        }
+        else
+        {
+            entries[i] = Impl::make_entry(name, std::get<std::span<const uint8_t>>(data), p_impl->compression_policy, p_impl->chunk_size, p_impl->dictionary, 1);
+        }
+    });
+
+    for (auto& entry : entries)
+    {
+        p_impl->add_entry(std::move(entry));
+    }
+}
+
+std::optional<ArchiveEntry> RezipArchive::Find(const std::string_view name) const
+{
+    if (p_impl->has_disk_name_index())
+    {
+        const auto index = p_impl->find_in_disk_name_index(name);
+        if (!index)
+        {
+            return std::nullopt;
+        }
+        return p_impl->make_archive_entry(*index);
+    }
+
+    const auto index = p_impl->name_index.Find(name);
+    if (!index)
+    {
+        return std::nullopt;
+    }
+
+    return p_impl->make_archive_entry(*index);
+}
+
+std::vector<ArchiveEntry> RezipArchive::FindPrefix(const std::string_view prefix) const
+{
+    std::vector<ArchiveEntry> found;
+    const auto& impl = *p_impl;
+
+    if (impl.has_disk_name_index())
+    {
+        const auto& table = p_impl->disk_name_index;
+        const auto get_entry_number = [&](uint32_t i) {
+            const uint32_t entry = table.GetSortedEntry(i);
+            Lud::check::that(entry < table.entry_count, "Name index does not match the central directory");
+            return entry;
+        };
+
+        const auto sorted = std::views::iota(uint32_t{0}, table.entry_count);
+        const auto first = std::ranges::partition_point(sorted, [&](uint32_t i) {
+            return impl.get_entry(get_entry_number(i)).name < prefix;
+        });
+        for (auto it = first; it != sorted.end(); ++it)
+        {
+            const uint32_t entry = get_entry_number(*it);
+            if (!impl.get_entry(entry).name.starts_with(prefix))
+            {
+                break;
+            }
+            found.emplace_back(p_impl->make_archive_entry(entry));
+        }
+        return found;
+    }
+
+    for (size_t i = 0; i < impl.get_slot_count(); i++)
+    {
+        if (impl.is_alive(i) && impl.get_entry(i).name.starts_with(prefix))
+        {
+            found.emplace_back(p_impl->make_archive_entry(i));
+        }
+    }
+    // ArchiveEntry can not be assigned, so it is sorted through indices
+    std::vector<size_t> order(found.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::ranges::stable_sort(order, {}, [&](size_t i) -> const std::string& { return found[i].file_name; });
+
+    std::vector<ArchiveEntry> sorted_found;
+    sorted_found.reserve(found.size());
+    for (const size_t i : order)
+    {
+        sorted_found.push_back(found[i]);
+    }
+    return sorted_found;
+}
+
+std::vector<ArchiveEntry> RezipArchive::GetDirectory() const
+{
+    std::vector<ArchiveEntry> directory;
+
+    const auto& impl = *p_impl;
+
+    directory.reserve(impl.get_slot_count());
+    for (size_t i = 0; i < impl.get_slot_count(); i++)
+    {
+        if (impl.is_alive(i))
+        {
+            directory.emplace_back(p_impl->make_archive_entry(i));
+        }
+    }
+    return directory;
+}
+
+void RezipArchive::Write(std::ostream& stream) const
+{
+    DeduplicationStats stats;
+    Write(stream, stats);
+}
+
+void RezipArchive::Write(std::ostream& stream, DeduplicationStats& stats) const
+{
+    const auto& impl = *p_impl;
+
+    std::vector<CentralDirectoryHeader> central_directory;
+    central_directory.reserve(impl.get_slot_count());
+
+    uint64_t total_written = 0;
+    uint64_t central_directory_size = 0;
+
+    // payloads already written by their crc and sizes, candidates are compared byte by byte
+    // so different payloads that collide are never merged
+    std::unordered_multimap<uint64_t, std::pair<uint64_t, const Impl::file_entry*>> written_payloads;
+    stats = {};
+
+    // lazily read entries are read into these
+    std::vector<uint8_t> buffer;
+    std::vector<uint8_t> written_buffer;
+
+    // small entries are decompressed into the current block, their directory headers
+    // get the offset of the block once it is written
+    std::vector<uint8_t> block_data;
+    std::vector<size_t> block_directory;
+    // entries of solid blocks that are written on their own, compressed again
+    std::deque<Impl::file_entry> repacked_entries;
+
+    const auto write_block = [&]() {
+        if (block_directory.empty())
+        {
+            return;
+        }
+
+        LocalFileHeader header{
+            .compressed_size = 0,
+            .uncompressed_size = block_data.size(),
+            .signature = Signatures::LOCAL_FILE_HEADER,
+            .CRC_32 = _detail_::crc32(block_data),
+            .compression_method = CompressionMethod::DEFLATE,
+        };
+        std::vector<uint8_t> compressed_data;
+        if (!_detail_::deflate_raw(block_data, p_impl->compression_policy.level, compressed_data))
+        {
+            compressed_data = block_data;
+            header.compression_method = CompressionMethod::NONE;
+        }
+        header.compressed_size = compressed_data.size();
+
+        write_local_file_header(stream, header);
+        WRITE_BINARY_PTR(stream, compressed_data.data(), compressed_data.size());
+
+        for (const size_t i : block_directory)
+        {
+            central_directory[i].offset = total_written;
+        }
+        total_written += get_local_file_header_size() + header.compressed_size;
+
+        block_data.clear();
+        block_directory.clear();
+    };
+
+    for (size_t i = 0; i < impl.get_slot_count(); i++)
+    {
+        if (!impl.is_alive(i))
+        {
+            continue;
+        }
+        const auto& archive_entry = impl.get_entry(i);
+        const bool is_deflated = archive_entry.header.compression_method != CompressionMethod::NONE
+                              && archive_entry.header.compression_method != CompressionMethod::DEFLATE_CHUNKED;
+        const uint64_t uncompressed_size = archive_entry.header.uncompressed_size;
+
+        // stored entries did not compress and chunked ones are meant to be read in parts, so both stay on their own
+        if (p_impl->solid_block_size > 0 && is_deflated && uncompressed_size < p_impl->solid_block_size)
+        {
+            if (block_data.size() + uncompressed_size > p_impl->solid_block_size)
+            {
+                write_block();
+            }
+
+            const uint64_t offset_in_block = block_data.size();
+            block_data.resize(offset_in_block + uncompressed_size);
+            p_impl->decompress(archive_entry, std::span(block_data).subspan(offset_in_block));
+
+            block_directory.push_back(central_directory.size());
+            central_directory.push_back({
+                .file_name = archive_entry.name,
+                .offset = 0,
+                .signature = Signatures::SOLID_CENTRAL_DIRECTORY_HEADER,
+                .file_name_length = static_cast<uint32_t>(archive_entry.name.size()),
+                .offset_in_block = offset_in_block,
+                .uncompressed_size = uncompressed_size,
+                .CRC_32 = archive_entry.header.CRC_32,
+            });
+            central_directory_size += get_central_directory_header_size(central_directory.back());
+            continue;
+        }
+
+        const Impl::file_entry* written_entry = &archive_entry;
+        if (archive_entry.header.compression_method == CompressionMethod::SOLID)
+        {
+            std::vector<uint8_t> uncompressed_data(uncompressed_size);
+            p_impl->decompress(archive_entry, uncompressed_data);
+            written_entry = &repacked_entries.emplace_back(Impl::make_entry(
+                archive_entry.name, uncompressed_data, p_impl->compression_policy, p_impl->chunk_size, p_impl->dictionary, 1));
+        }
+        const auto& entry = *written_entry;
+        const auto& lfh = entry.header;
+        const uint64_t key = (uint64_t{lfh.CRC_32} << 32) ^ lfh.compressed_size ^ (lfh.uncompressed_size << 1);
+
+        std::optional<uint64_t> offset;
+        const auto [first, last] = written_payloads.equal_range(key);
+        for (auto it = first; it != last && !offset; ++it)
+        {
+            const auto& [written_offset, written] = it->second;
+            const auto& written_lfh = written->header;
+            if (written_lfh.CRC_32 == lfh.CRC_32
+                && written_lfh.compression_method == lfh.compression_method
+                && written_lfh.uncompressed_size == lfh.uncompressed_size
+                && std::ranges::equal(p_impl->get_compressed_data(*written, written_buffer), p_impl->get_compressed_data(entry, buffer)))
+            {
+                offset = written_offset;
+            }
+        }
+
+        if (offset)
+        {
+            stats.deduplicated_entries++;
+            stats.saved_bytes += get_local_file_header_size() + lfh.compressed_size;
+        }
+        else
+        {
+            // readers only reach headers through the central directory, so the gap can hold anything
+            if (lfh.compression_method == CompressionMethod::NONE && p_impl->stored_alignment > 1)
+            {
+                const uint64_t misalignment = (total_written + get_local_file_header_size()) % p_impl->stored_alignment;
+                const uint64_t padding = misalignment == 0 ? 0 : p_impl->stored_alignment - misalignment;
+                for (uint64_t i = 0; i < padding; i++)
+                {
+                    stream.put(0);
+                }
+                total_written += padding;
+            }
+
+            offset = total_written;
+            written_payloads.emplace(key, std::pair{total_written, &entry});
+
+            const auto compressed_data = p_impl->get_compressed_data(entry, buffer);
+            write_local_file_header(stream, lfh);
+            WRITE_BINARY_PTR(stream, compressed_data.data(), compressed_data.size());
+
+            total_written += get_local_file_header_size() + lfh.compressed_size;
+        }
+
+        central_directory.emplace_back(
+            entry.name,
+            *offset,
+            Signatures::CENTRAL_DIRECTORY_HEADER,
+            static_cast<uint32_t>(entry.name.size())
         );
+        central_directory_size += get_central_directory_header_size(central_directory.back());
+    }
+    write_block();
+
+    // the name index says where each header is, so readers do not have to go through all of them
+    std::vector<uint64_t> header_offsets;
+    header_offsets.reserve(central_directory.size());
+    uint64_t header_offset = 0;
+    for (const auto& directory : central_directory)
+    {
+        write_central_directory_header(stream, directory);
+        header_offsets.push_back(header_offset);
+        header_offset += get_central_directory_header_size(directory);
+    }
+
+    if (!p_impl->dictionary.empty())
+    {
+        const ExtensionRecord record{
+            .signature = Signatures::EXTENSION_RECORD,
+            .type = ExtensionType::DICTIONARY,
+            .size = p_impl->dictionary.size(),
+            .data = p_impl->dictionary,
+        };
+        write_extension_record(stream, record);
+        central_directory_size += get_extension_record_size(record);
+    }
+
+    if (p_impl->write_name_index)
+    {
+        std::vector<std::string_view> names(central_directory.size());
+        std::ranges::transform(central_directory, names.begin(), &CentralDirectoryHeader::file_name);
+
+        const auto name_index = make_name_index(names, header_offsets, header_offset);
+        const ExtensionRecord record{
+            .signature = Signatures::EXTENSION_RECORD,
+            .type = ExtensionType::NAME_INDEX,
+            .size = name_index.size(),
+            .data = name_index,
+        };
+        write_extension_record(stream, record);
+        central_directory_size += get_extension_record_size(record);
+    }
+
+    EndOfCentralDirectoryRecord eocd{
+        .offset = total_written,
+        .central_directory_size = central_directory_size,
+        .signature = Signatures::END_OF_CENTRAL_DIRECTORY_RECORD,
+        .directory_record_number = static_cast<uint32_t>(central_directory.size()),
+    };
+
+    write_end_of_central_directory_record(stream, eocd);
+}
+
+void RezipArchive::SetCompressionPolicy(CompressionPolicy policy)
+{
+    p_impl->compression_policy = std::move(policy);
+}
+
+void RezipArchive::PushRaw(const std::string_view name, RawArchiveEntry entry)
+{
+    p_impl->add_entry(Impl::make_raw_entry(name, std::move(entry)));
+}
+
+void RezipArchive::SetDictionary(std::span<const uint8_t> dictionary)
+{
+    // deflate can not look further back than its window
+    dictionary = dictionary.last(std::min<size_t>(dictionary.size(), MAX_DICTIONARY_SIZE));
+
+    p_impl->read_directory();
+    const bool in_use = std::ranges::any_of(p_impl->file_entries.Values(), [](const auto& entry) {
+        return entry.header.compression_method == CompressionMethod::DEFLATE_DICTIONARY;
+    });
+    Lud::check::that(
+        !in_use || std::ranges::equal(dictionary, p_impl->dictionary),
+        "The dictionary is used by entries of the archive"
+    );
+
+    p_impl->dictionary.assign(dictionary.begin(), dictionary.end());
+}
+
+std::vector<uint8_t> RezipArchive::TrainDictionary(std::span<const std::span<const uint8_t>> samples, size_t size)
+{
+    return _detail_::train_dictionary(samples, std::min<size_t>(size, MAX_DICTIONARY_SIZE));
+}
+
+void RezipArchive::SetChunkSize(uint32_t chunk_size)
+{
+    p_impl->chunk_size = chunk_size;
+}
+
+void RezipArchive::SetSolidBlockSize(uint32_t block_size)
+{
+    p_impl->solid_block_size = block_size;
+}
+
+void RezipArchive::SetStoredAlignment(uint32_t alignment)
+{
+    p_impl->stored_alignment = alignment;
+}
+
+void RezipArchive::SetNameIndex(bool write_name_index)
+{
+    p_impl->write_name_index = write_name_index;
+}
+
+RawArchiveEntry RezipArchive::PeekRaw(const ArchiveEntry& entry) const
+{
+    const auto& file_entry = p_impl->get_entry(entry);
+    const auto& lfh = file_entry.header;
+
+    // the dictionary or the rest of the block can not go with the entry, so it is compressed again on its own
+    if (lfh.compression_method == CompressionMethod::DEFLATE_DICTIONARY || lfh.compression_method == CompressionMethod::SOLID)
+    {
+        RawArchiveEntry raw{
+            .compressed_data = {},
+            .compression = archive_compression::deflate,
+            .crc = lfh.CRC_32,
+            .uncompressed_size = lfh.uncompressed_size,
+        };
+        auto uncompressed_data = Peek(entry);
+        if (!_detail_::deflate_raw(uncompressed_data, p_impl->compression_policy.level, raw.compressed_data))
+        {
+            raw.compressed_data = std::move(uncompressed_data);
+            raw.compression = archive_compression::none;
+        }
+        return raw;
+    }
+    // the chunks of chunked entries already form a single deflate stream
+    std::vector<uint8_t> buffer;
+    const auto compressed_data = p_impl->get_deflate_stream(file_entry, buffer);
+
+    return {
+        .compressed_data = {compressed_data.begin(), compressed_data.end()},
+        .compression = lfh.compression_method == CompressionMethod::NONE ? archive_compression::none : archive_compression::deflate,
+        .crc = lfh.CRC_32,
+        .uncompressed_size = lfh.uncompressed_size,
+    };
+}
+
+std::vector<uint8_t> RezipArchive::Peek(const ArchiveEntry& entry) const
+{
+    const auto& file_entry = p_impl->get_entry(entry);
+
+    std::vector<uint8_t> uncompressed_data(file_entry.header.uncompressed_size);
+    p_impl->decompress(file_entry, uncompressed_data);
+
+    return uncompressed_data;
+}
+
+std::span<uint8_t> RezipArchive::Peek(const ArchiveEntry& entry, std::span<uint8_t> output) const
+{
+    return p_impl->decompress(p_impl->get_entry(entry), output);
+}
+
+std::span<const uint8_t> RezipArchive::View(const ArchiveEntry& entry, std::vector<uint8_t>& scratch) const
+{
+    const auto& file_entry = p_impl->get_entry(entry);
+    const auto& lfh = file_entry.header;
+    const auto& name = file_entry.name;
+
+    if (lfh.compression_method != CompressionMethod::NONE)
+    {
+        return Peek(entry, scratch);
+    }
+
+    // stored entries held in memory already are their data, ones read from a stream are read into scratch
+    const auto data = p_impl->get_compressed_data(file_entry, scratch).first(lfh.uncompressed_size);
+
+#ifdef VARF_DO_CRC_32
+    Lud::check::eq(
+        lfh.CRC_32,
+        _detail_::crc32(data),
+        std::format("File: [{}] is corrupted and can not be recovered", name));
+#endif
+
+    return data;
+}
+
+std::span<uint8_t> RezipArchive::PeekRange(const ArchiveEntry& entry, uint64_t offset, std::span<uint8_t> output) const
+{
+    const auto& file_entry = p_impl->get_entry(entry);
+    const auto& lfh = file_entry.header;
+    const auto& name = file_entry.name;
+
+    Lud::check::that(offset <= lfh.uncompressed_size, std::format("File: [{}] is smaller than the offset", name));
+    const auto range = output.first(std::min<uint64_t>(output.size(), lfh.uncompressed_size - offset));
+    if (range.empty())
+    {
+        return range;
+    }
+
+    std::vector<uint8_t> buffer;
+    if (lfh.compression_method == CompressionMethod::NONE)
+    {
+        // only the range is read from a source
+        const auto data = file_entry.loaded
+                            ? std::span<const uint8_t>(file_entry.compressed_data).subspan(offset, range.size())
+                            : p_impl->read_source(file_entry.offset + offset, range.size(), buffer);
+        std::ranges::copy(data, range.begin());
+        return range;
+    }
+
+    if (lfh.compression_method != CompressionMethod::DEFLATE_CHUNKED)
+    {
+        // a single stream has to be inflated from its start
+        auto stream = Open(entry);
+        stream->ignore(static_cast<std::streamsize>(offset));
+        READ_BINARY_PTR((*stream), range.data(), range.size());
+        Lud::check::that(stream->good(), std::format("File: [{}] is corrupted and can not be recovered", name));
+        return range;
+    }
+
+    // only the chunks overlapping the range are inflated
+    std::vector<uint8_t> compressed_buffer;
+    const auto table = read_chunk_table(p_impl->get_compressed_data(file_entry, compressed_buffer), lfh.uncompressed_size);
+    const uint64_t first_chunk = offset / table.chunk_size;
+    const uint64_t last_chunk = (offset + range.size() - 1) / table.chunk_size;
+
+    for (uint64_t i = first_chunk; i <= last_chunk; i++)
+    {
+        const uint64_t chunk_begin = i * table.chunk_size;
+        const uint64_t chunk_size = std::min<uint64_t>(table.chunk_size, lfh.uncompressed_size - chunk_begin);
+        const uint64_t copy_begin = std::max(offset, chunk_begin);
+        const uint64_t copy_end = std::min(offset + range.size(), chunk_begin + chunk_size);
+        const auto destination = range.subspan(copy_begin - offset, copy_end - copy_begin);
+
+        // chunks fully inside the range are inflated in place
+        const bool whole_chunk = destination.size() == chunk_size;
+        if (!whole_chunk)
+        {
+            buffer.resize(chunk_size);
+        }
+        const auto chunk = whole_chunk ? destination : std::span(buffer);
+
+        Lud::check::that(
+            _detail_::inflate_raw(table.GetChunk(i), chunk, i + 1 == table.chunk_count),
+            std::format("File: [{}] is corrupted and can not be recovered", name));
+
+        if (!whole_chunk)
+        {
+            std::copy_n(buffer.begin() + static_cast<std::ptrdiff_t>(copy_begin - chunk_begin), destination.size(), destination.begin());
+        }
+    }
+
+    return range;
+}
+
+std::unique_ptr<std::istream> RezipArchive::Open(const ArchiveEntry& entry) const
+{
+    const auto& file_entry = p_impl->get_entry(entry);
+    const auto& lfh = file_entry.header;
+
+    // the inflate stream can not take a dictionary nor start inside a block, those entries are small and inflated at once
+    if (lfh.compression_method == CompressionMethod::DEFLATE_DICTIONARY || lfh.compression_method == CompressionMethod::SOLID)
+    {
+        return std::make_unique<_detail_::EntryIstream>(
+            std::make_unique<_detail_::BufferStreambuf>(Peek(entry)),
+            false,
+            lfh.CRC_32
+        );
+    }
+
+    const bool deflated = lfh.compression_method != CompressionMethod::NONE;
+    if (file_entry.loaded || p_impl->source == nullptr)
+    {
+        // entries held in memory are viewed in place, the buffer is not used
+        std::vector<uint8_t> unused;
+        return std::make_unique<_detail_::EntryIstream>(
+            std::make_unique<_detail_::SpanStreambuf>(p_impl->get_deflate_stream(file_entry, unused)),
+            deflated,
+            lfh.CRC_32
+        );
+    }
+
+    // the deflate stream of chunked entries starts after the chunk count and the end of each chunk
+    uint64_t table_size = 0;
+    if (lfh.compression_method == CompressionMethod::DEFLATE_CHUNKED)
+    {
+        std::vector<uint8_t> buffer;
+        uint32_t chunk_count;
+        std::memcpy(&chunk_count, p_impl->read_source(file_entry.offset + sizeof(uint32_t), sizeof(chunk_count), buffer).data(), sizeof(chunk_count));
+        table_size = 2 * sizeof(uint32_t) + uint64_t{chunk_count} * sizeof(uint64_t);
+        Lud::check::that(table_size <= lfh.compressed_size, std::format("File: [{}] is corrupted and can not be recovered", file_entry.name));
+    }
+
+    return std::make_unique<_detail_::EntryIstream>(
+        std::make_unique<_detail_::SourceStreambuf>(*p_impl->source, p_impl->source_mutex, file_entry.offset + table_size, lfh.compressed_size - table_size),
+        deflated,
+        lfh.CRC_32
+    );
+}
+
+std::vector<uint8_t> RezipArchive::Pop(const ArchiveEntry& entry)
+{
+    const auto file_entry_to_remove = p_impl->remove_entry(entry);
+
+    std::vector<uint8_t> uncompressed_data(file_entry_to_remove.header.uncompressed_size);
+    p_impl->decompress(file_entry_to_remove, uncompressed_data);
+
+    return uncompressed_data;
+}
+
+void RezipArchive::read(std::istream& stream, ArchiveMode mode)
+{
+    Lud::check::in(mode, {archive_mode::eager, archive_mode::lazy}, "Rezip archives can not be opened for update");
+
+    constexpr auto eocd_size = static_cast<std::streamoff>(get_end_of_central_directory_record_size());
+
+    stream.seekg(-eocd_size, std::ios::end);
+
+    auto eocd = read_end_of_central_directory_record(stream);
+
+    // the whole directory is read at once and parsed from memory, or viewed if the archive is in memory
+    std::vector<uint8_t> central_directory_data;
+    std::span<const uint8_t> central_directory;
+    const auto& source_data = p_impl->source_data;
+    if (!source_data.empty())
+    {
+        Lud::check::that(
+            eocd.offset <= source_data.size() && eocd.central_directory_size <= source_data.size() - eocd.offset,
+            "Could not read central directory");
+        central_directory = source_data.subspan(eocd.offset, eocd.central_directory_size);
+    }
+    else
+    {
+        central_directory_data.resize(eocd.central_directory_size);
+        stream.seekg(static_cast<std::streamoff>(eocd.offset), std::ios::beg);
+        READ_BINARY_PTR(stream, central_directory_data.data(), central_directory_data.size());
+        Lud::check::that(stream.good(), "Could not read central directory");
+        central_directory = central_directory_data;
+    }
+
+    const auto read_extension_records = [&](_detail_::SpanReader& reader) {
+        const uint64_t extensions_offset = central_directory.size() - reader.GetRemaining();
+        while (reader.GetRemaining() > 0)
+        {
+            const auto record = read_extension_record(reader);
+            if (record.type == ExtensionType::DICTIONARY)
+            {
+                p_impl->dictionary.assign(record.data.begin(), record.data.end());
+            }
+            else if (record.type == ExtensionType::NAME_INDEX)
+            {
+                p_impl->disk_name_index = read_name_index(record.data, eocd.directory_record_number, extensions_offset);
+            }
+        }
+        // the index views the directory
+        if (p_impl->has_disk_name_index())
+        {
+            p_impl->directory_data = std::move(central_directory_data);
+            p_impl->directory = central_directory;
+        }
+    };
+
+    const bool lazy = mode & archive_mode::lazy;
+    // with a name index, lazily read archives parse each header when it is first used
+    if (lazy)
+    {
+        if (const auto extensions_offset = find_extension_records(central_directory))
+        {
+            _detail_::SpanReader reader(central_directory.subspan(*extensions_offset));
+            read_extension_records(reader);
+            p_impl->directory_read = false;
+            return;
+        }
+    }
+
+    _detail_::SpanReader reader(central_directory);
+
+    // lazily read entries only keep where their data is, it is read when it is needed
+    const auto read_data = [&](uint64_t offset) {
+        stream.seekg(static_cast<std::streamoff>(offset));
+
+        auto lfh = read_local_file_header(stream);
+        std::vector<uint8_t> compressed_data;
+        if (!lazy)
+        {
+            compressed_data.resize(lfh.compressed_size);
+            READ_BINARY_PTR(stream, compressed_data.data(), compressed_data.size());
+        }
+        Lud::check::that(stream.good(), "Could not read entry data");
+
+        return std::tuple{lfh, std::move(compressed_data), offset + get_local_file_header_size()};
+    };
+
+    // each block is read once, every entry in it shares it
+    std::unordered_map<uint64_t, std::shared_ptr<const Impl::solid_block>> blocks;
+
+    for (size_t i = 0; i < eocd.directory_record_number; i++)
+    {
+        p_impl->file_entries.Insert(Impl::make_read_entry(read_central_directory_header(reader), blocks, !lazy, read_data));
+    }
+
+    read_extension_records(reader);
+
+    // the names are only indexed in memory if the archive has no index
+    if (!p_impl->has_disk_name_index())
+    {
+        p_impl->build_name_index();
     }
 }
 
@@ -1,6 +1,9 @@
 #include "archive/zip.hpp"
+#include "archive/archive_internal.hpp"
+#include "archive/crc32.hpp"
 
 #include <comp_streams/CompStreams.hpp>
+#include <zlib.h>
 
 #define READ_BINARY_PTR(stream, ptr, sz) stream.read(reinterpret_cast<char*>(ptr), (sz))
 #define READ_BINARY(stream, var) READ_BINARY_PTR((stream), &(var), sizeof(var))
@@ -18,6 +21,8 @@ enum Enum : uint32_t
     END_OF_CENTRAL_DIRECTORY_RECORD = 0x06054b50,
     CENTRAL_DIRECTORY_HEADER = 0x02014b50,
     DATA_DESCRIPTOR = 0x08074b50,
+    ZIP64_END_OF_CENTRAL_DIRECTORY_RECORD = 0x06064b50,
+    ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR = 0x07064b50,
 };
 }; // namespace signatures_NS
 
@@ -29,8 +34,31 @@ enum Enum : uint16_t // NOLINT
 };
 }; // namespace compression_method_NS
 
+namespace general_purpose_flags_NS {
+enum Enum : uint16_t // NOLINT
+{
+    DATA_DESCRIPTOR = 0x0008,
+};
+}; // namespace general_purpose_flags_NS
+
+namespace extra_field_tags_NS {
+enum Enum : uint16_t // NOLINT
+{
+    ZIP64 = 0x0001,
+};
+}; // namespace extra_field_tags_NS
+
 using Signatures = signatures_NS::Enum;
 using CompressionMethod = compression_method_NS::Enum;
+using GeneralPurposeFlags = general_purpose_flags_NS::Enum;
+using ExtraFieldTags = extra_field_tags_NS::Enum;
+
+// values that do not fit in the regular records are set to this
+// and stored in the zip64 extra field or zip64 EOCD instead
+constexpr uint32_t ZIP64_LIMIT = 0xFFFFFFFF;
+constexpr uint16_t ZIP64_LIMIT_16 = 0xFFFF;
+// version needed to extract zip64 records
+constexpr uint16_t ZIP64_VERSION = 45;
 
 struct LocalFileHeader
 {
@@ -41,20 +69,24 @@ struct LocalFileHeader
     uint16_t file_last_modification_time{};
     uint16_t file_last_modification_date{};
     uint32_t CRC_32{};
-    uint32_t compressed_size{};
-    uint32_t uncompressed_size{};
+    uint64_t compressed_size{};
+    uint64_t uncompressed_size{};
     uint16_t file_name_length{};
     uint16_t extra_field_length{};
 
     std::string file_name{};
     std::vector<uint8_t> extra_field{};
+
+    // not part of the record, forces the zip64 extra field even if sizes fit in 32 bits
+    // needed when sizes are not known before writing the header
+    bool zip64{};
 };
 struct DataDescriptor
 {
     uint32_t optional_signature{};
     uint32_t CRC_32{};
-    uint32_t compressed_size{};
-    uint32_t uncompressed_size{};
+    uint64_t compressed_size{};
+    uint64_t uncompressed_size{};
 };
 struct CentralDirectoryHeader
 {
@@ -66,15 +98,15 @@ struct CentralDirectoryHeader
     uint16_t file_last_modification_time{};
     uint16_t file_last_modification_date{};
     uint32_t CRC_32{};
-    uint32_t compressed_size{};
-    uint32_t uncompressed_size{};
+    uint64_t compressed_size{};
+    uint64_t uncompressed_size{};
     uint16_t file_name_length{};
     uint16_t extra_field_length{};
     uint16_t file_comment_length{};
     uint16_t disk_start{};
     uint16_t internal_file_attrib{};
     uint32_t external_file_attrib{};
-    uint32_t offset{};
+    uint64_t offset{};
 
     std::string file_name{};
     std::vector<uint8_t> extra_field{};
@@ -85,13 +117,33 @@ struct EndOfCentralDirectoryRecord
     uint32_t signature{};
     uint16_t disk_number{};
     uint16_t disk_start_number{};
-    uint16_t directory_record_number_disk{};
-    uint16_t directory_record_number{};
-    uint32_t central_directory_size{};
-    uint32_t offset{};
+    uint64_t directory_record_number_disk{};
+    uint64_t directory_record_number{};
+    uint64_t central_directory_size{};
+    uint64_t offset{};
     uint16_t comment_length{};
     std::string comment{};
 };
+struct Zip64EndOfCentralDirectoryRecord
+{
+    uint32_t signature{};
+    uint64_t record_size{};
+    uint16_t version_made_by{};
+    uint16_t version_to_extract{};
+    uint32_t disk_number{};
+    uint32_t disk_start_number{};
+    uint64_t directory_record_number_disk{};
+    uint64_t directory_record_number{};
+    uint64_t central_directory_size{};
+    uint64_t offset{};
+};
+struct Zip64EndOfCentralDirectoryLocator
+{
+    uint32_t signature{};
+    uint32_t disk_start_number{};
+    uint64_t offset{};
+    uint32_t disk_count{};
+};
 } // namespace
 static std::vector<uint8_t> slurp(std::istream& stream)
 {
@@ -104,9 +156,87 @@ static std::vector<uint8_t> slurp(std::istream& stream)
     return data;
 }
 
+static std::vector<uint8_t> make_zip64_extra_field(std::span<const uint64_t> values)
+{
+    const auto tag = static_cast<uint16_t>(ExtraFieldTags::ZIP64);
+    const auto size = static_cast<uint16_t>(values.size_bytes());
+
+    std::vector<uint8_t> extra_field(4 + values.size_bytes());
+    std::memcpy(extra_field.data(), &tag, 2);
+    std::memcpy(extra_field.data() + 2, &size, 2);
+    std::memcpy(extra_field.data() + 4, values.data(), values.size_bytes());
+
+    return extra_field;
+}
+
+static std::optional<std::span<const uint8_t>> find_extra_field(std::span<const uint8_t> extra_field, uint16_t tag)
+{
+    while (extra_field.size() >= 4)
+    {
+        uint16_t field_tag;
+        uint16_t size;
+        std::memcpy(&field_tag, extra_field.data(), 2);
+        std::memcpy(&size, extra_field.data() + 2, 2);
+        Lud::check::that(extra_field.size() - 4 >= size, "Incorrect extra field size");
+
+        if (field_tag == tag)
+        {
+            return extra_field.subspan(4, size);
+        }
+        extra_field = extra_field.subspan(4 + size);
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief Replaces the values set to the zip64 limit with the ones stored in the zip64 extra field
+ *        values are stored in the extra field in the same order they appear in the record
+ *
+ * @param extra_field the extra field of a record
+ * @param values pointers to the record values and the limit that marks them as stored in zip64
+ */
+static void read_zip64_extra_field(std::span<const uint8_t> extra_field, std::initializer_list<std::pair<uint64_t*, uint64_t>> values)
+{
+    if (std::ranges::none_of(values, [](const auto& value) { return *value.first == value.second; }))
+    {
+        return;
+    }
+
+    auto zip64_data = find_extra_field(extra_field, ExtraFieldTags::ZIP64).value_or(std::span<const uint8_t>{});
+    for (const auto& [value, limit] : values)
+    {
+        if (*value != limit)
+        {
+            continue;
+        }
+        Lud::check::that(zip64_data.size() >= 8, "Missing zip64 extra field");
+
+        std::memcpy(value, zip64_data.data(), 8);
+        zip64_data = zip64_data.subspan(8);
+    }
+}
+
+static bool is_zip64(const LocalFileHeader& lfh)
+{
+    return lfh.zip64 || lfh.compressed_size >= ZIP64_LIMIT || lfh.uncompressed_size >= ZIP64_LIMIT;
+}
+
+static std::vector<uint8_t> get_local_file_header_extra_field(const LocalFileHeader& lfh)
+{
+    if (!is_zip64(lfh))
+    {
+        return lfh.extra_field;
+    }
+    // the local header zip64 extra field must contain both sizes
+    const std::array<uint64_t, 2> values{lfh.uncompressed_size, lfh.compressed_size};
+    return make_zip64_extra_field(values);
+}
+
 static LocalFileHeader read_local_file_header(std::istream& stream)
 {
     LocalFileHeader lfh;
+    uint32_t compressed_size;
+    uint32_t uncompressed_size;
     READ_BINARY(stream, lfh.signature);
     READ_BINARY(stream, lfh.version);
     READ_BINARY(stream, lfh.gen_purpose_flag);
@@ -114,8 +244,8 @@ static LocalFileHeader read_local_file_header(std::istream& stream)
     READ_BINARY(stream, lfh.file_last_modification_time);
     READ_BINARY(stream, lfh.file_last_modification_date);
     READ_BINARY(stream, lfh.CRC_32);
-    READ_BINARY(stream, lfh.compressed_size);
-    READ_BINARY(stream, lfh.uncompressed_size);
+    READ_BINARY(stream, compressed_size);
+    READ_BINARY(stream, uncompressed_size);
     READ_BINARY(stream, lfh.file_name_length);
     READ_BINARY(stream, lfh.extra_field_length);
 
@@ -142,123 +272,169 @@ static LocalFileHeader read_local_file_header(std::istream& stream)
         "Unknown compression method"
     );
 
+    lfh.compressed_size = compressed_size;
+    lfh.uncompressed_size = uncompressed_size;
+    // data descriptors use 64 bit sizes if the zip64 extra field is present
+    lfh.zip64 = find_extra_field(lfh.extra_field, ExtraFieldTags::ZIP64).has_value();
+    read_zip64_extra_field(lfh.extra_field, {
+        {&lfh.uncompressed_size, ZIP64_LIMIT},
+        {&lfh.compressed_size,   ZIP64_LIMIT},
+    });
+
+    // stored data is copied using the uncompressed size, both have to match
+    Lud::check::that(
+        lfh.compression_method != CompressionMethod::NONE || lfh.compressed_size == lfh.uncompressed_size,
+        "Stored entry sizes do not match"
+    );
+
     return lfh;
 }
 
 static void write_local_file_header(std::ostream& stream, const LocalFileHeader& lfh)
 {
+    const bool zip64 = is_zip64(lfh);
+    const uint16_t version = zip64 ? std::max(lfh.version, ZIP64_VERSION) : lfh.version;
+    const uint32_t compressed_size = zip64 ? ZIP64_LIMIT : static_cast<uint32_t>(lfh.compressed_size);
+    const uint32_t uncompressed_size = zip64 ? ZIP64_LIMIT : static_cast<uint32_t>(lfh.uncompressed_size);
+    const auto extra_field = get_local_file_header_extra_field(lfh);
+    const auto extra_field_length = static_cast<uint16_t>(extra_field.size());
+
     WRITE_BINARY(stream, lfh.signature);
-    WRITE_BINARY(stream, lfh.version);
+    WRITE_BINARY(stream, version);
     WRITE_BINARY(stream, lfh.gen_purpose_flag);
     WRITE_BINARY(stream, lfh.compression_method);
     WRITE_BINARY(stream, lfh.file_last_modification_time);
     WRITE_BINARY(stream, lfh.file_last_modification_date);
     WRITE_BINARY(stream, lfh.CRC_32);
-    WRITE_BINARY(stream, lfh.compressed_size);
-    WRITE_BINARY(stream, lfh.uncompressed_size);
+    WRITE_BINARY(stream, compressed_size);
+    WRITE_BINARY(stream, uncompressed_size);
     WRITE_BINARY(stream, lfh.file_name_length);
-    WRITE_BINARY(stream, lfh.extra_field_length);
+    WRITE_BINARY(stream, extra_field_length);
 
     if (lfh.file_name_length > 0)
     {
         WRITE_BINARY_PTR(stream, lfh.file_name.data(), lfh.file_name_length);
     }
-    if (lfh.extra_field_length > 0)
+    if (extra_field_length > 0)
     {
-        WRITE_BINARY_PTR(stream, lfh.extra_field.data(), lfh.extra_field_length);
+        WRITE_BINARY_PTR(stream, extra_field.data(), extra_field_length);
     }
 }
 
-static constexpr uint32_t get_local_file_header_size(const LocalFileHeader& lfh)
+static uint64_t get_local_file_header_size(const LocalFileHeader& lfh)
 {
-    return 30U + lfh.file_name_length + lfh.extra_field_length;
+    return 30U + lfh.file_name_length + get_local_file_header_extra_field(lfh).size();
 }
 
-static CentralDirectoryHeader read_central_directory_header(std::istream& stream)
+static CentralDirectoryHeader read_central_directory_header(_detail_::SpanReader& reader)
 {
     CentralDirectoryHeader cdh;
-    READ_BINARY(stream, cdh.signature);
-    READ_BINARY(stream, cdh.version_made_by);
-    READ_BINARY(stream, cdh.version_to_extract);
-    READ_BINARY(stream, cdh.gen_purpose_flag);
-    READ_BINARY(stream, cdh.compression_method);
-    READ_BINARY(stream, cdh.file_last_modification_time);
-    READ_BINARY(stream, cdh.file_last_modification_date);
-    READ_BINARY(stream, cdh.CRC_32);
-    READ_BINARY(stream, cdh.compressed_size);
-    READ_BINARY(stream, cdh.uncompressed_size);
-    READ_BINARY(stream, cdh.file_name_length);
-    READ_BINARY(stream, cdh.extra_field_length);
-    READ_BINARY(stream, cdh.file_comment_length);
-    READ_BINARY(stream, cdh.disk_start);
-    READ_BINARY(stream, cdh.internal_file_attrib);
-    READ_BINARY(stream, cdh.external_file_attrib);
-    READ_BINARY(stream, cdh.offset);
-
-    if (cdh.file_name_length > 0)
-    {
-        cdh.file_name.resize(cdh.file_name_length);
-        READ_BINARY_PTR(stream, cdh.file_name.data(), cdh.file_name_length);
-    }
-
-    if (cdh.extra_field_length > 0)
-    {
-        cdh.extra_field.resize(cdh.extra_field_length);
-        READ_BINARY_PTR(stream, cdh.extra_field.data(), cdh.extra_field_length);
-    }
-
-    if (cdh.file_comment_length > 0)
-    {
-        cdh.file_comment.reserve(cdh.file_comment_length);
-        READ_BINARY_PTR(stream, cdh.file_comment.data(), cdh.file_comment_length);
-    }
-
-    const auto current_pos = stream.tellg();
-    stream.seekg(static_cast<std::streamoff>(cdh.offset), std::ios::beg);
-    uint32_t lfh_signature;
-    READ_BINARY(stream, lfh_signature);
-    stream.seekg(current_pos, std::ios::beg);
+    uint32_t compressed_size;
+    uint32_t uncompressed_size;
+    uint32_t offset;
+    reader.Read(cdh.signature);
 
     Lud::check::that(
         cdh.signature == Signatures::CENTRAL_DIRECTORY_HEADER,
         "Incorrect central directory header signature"
     );
 
-    Lud::check::that(
-        lfh_signature == Signatures::LOCAL_FILE_HEADER,
-        "central directory header offset does not point to local file header"
-    );
+    reader.Read(cdh.version_made_by);
+    reader.Read(cdh.version_to_extract);
+    reader.Read(cdh.gen_purpose_flag);
+    reader.Read(cdh.compression_method);
+    reader.Read(cdh.file_last_modification_time);
+    reader.Read(cdh.file_last_modification_date);
+    reader.Read(cdh.CRC_32);
+    reader.Read(compressed_size);
+    reader.Read(uncompressed_size);
+    reader.Read(cdh.file_name_length);
+    reader.Read(cdh.extra_field_length);
+    reader.Read(cdh.file_comment_length);
+    reader.Read(cdh.disk_start);
+    reader.Read(cdh.internal_file_attrib);
+    reader.Read(cdh.external_file_attrib);
+    reader.Read(offset);
+
+    const auto file_name = reader.ReadBytes(cdh.file_name_length);
+    cdh.file_name.assign(file_name.begin(), file_name.end());
+
+    const auto extra_field = reader.ReadBytes(cdh.extra_field_length);
+    cdh.extra_field.assign(extra_field.begin(), extra_field.end());
+
+    const auto file_comment = reader.ReadBytes(cdh.file_comment_length);
+    cdh.file_comment.assign(file_comment.begin(), file_comment.end());
+
+    cdh.compressed_size = compressed_size;
+    cdh.uncompressed_size = uncompressed_size;
+    cdh.offset = offset;
+    read_zip64_extra_field(cdh.extra_field, {
+        {&cdh.uncompressed_size, ZIP64_LIMIT},
+        {&cdh.compressed_size,   ZIP64_LIMIT},
+        {&cdh.offset,            ZIP64_LIMIT},
+    });
+
+    // the local file header signature is checked when its data is read
 
     return cdh;
 }
 
+static std::vector<uint8_t> get_central_directory_header_extra_field(const CentralDirectoryHeader& cdh)
+{
+    std::vector<uint64_t> values;
+    for (const uint64_t value : {cdh.uncompressed_size, cdh.compressed_size, cdh.offset})
+    {
+        if (value >= ZIP64_LIMIT)
+        {
+            values.push_back(value);
+        }
+    }
+    if (values.empty())
+    {
+        return cdh.extra_field;
+    }
+    return make_zip64_extra_field(values);
+}
+
 void write_central_directory_header(std::ostream& stream, const CentralDirectoryHeader& cdh)
 {
+    const auto extra_field = get_central_directory_header_extra_field(cdh);
+    const auto extra_field_length = static_cast<uint16_t>(extra_field.size());
+    const bool zip64 = extra_field != cdh.extra_field;
+
+    const auto truncate = [](uint64_t value) {
+        return value >= ZIP64_LIMIT ? ZIP64_LIMIT : static_cast<uint32_t>(value);
+    };
+    const uint16_t version_to_extract = zip64 ? std::max(cdh.version_to_extract, ZIP64_VERSION) : cdh.version_to_extract;
+    const uint32_t compressed_size = truncate(cdh.compressed_size);
+    const uint32_t uncompressed_size = truncate(cdh.uncompressed_size);
+    const uint32_t offset = truncate(cdh.offset);
+
     WRITE_BINARY(stream, cdh.signature);
     WRITE_BINARY(stream, cdh.version_made_by);
-    WRITE_BINARY(stream, cdh.version_to_extract);
+    WRITE_BINARY(stream, version_to_extract);
     WRITE_BINARY(stream, cdh.gen_purpose_flag);
     WRITE_BINARY(stream, cdh.compression_method);
     WRITE_BINARY(stream, cdh.file_last_modification_time);
     WRITE_BINARY(stream, cdh.file_last_modification_date);
     WRITE_BINARY(stream, cdh.CRC_32);
-    WRITE_BINARY(stream, cdh.compressed_size);
-    WRITE_BINARY(stream, cdh.uncompressed_size);
+    WRITE_BINARY(stream, compressed_size);
+    WRITE_BINARY(stream, uncompressed_size);
     WRITE_BINARY(stream, cdh.file_name_length);
-    WRITE_BINARY(stream, cdh.extra_field_length);
+    WRITE_BINARY(stream, extra_field_length);
     WRITE_BINARY(stream, cdh.file_comment_length);
     WRITE_BINARY(stream, cdh.disk_start);
     WRITE_BINARY(stream, cdh.internal_file_attrib);
     WRITE_BINARY(stream, cdh.external_file_attrib);
-    WRITE_BINARY(stream, cdh.offset);
+    WRITE_BINARY(stream, offset);
 
     if (cdh.file_name_length > 0)
     {
         WRITE_BINARY_PTR(stream, cdh.file_name.data(), cdh.file_name_length);
     }
-    if (cdh.extra_field_length > 0)
+    if (extra_field_length > 0)
     {
-        WRITE_BINARY_PTR(stream, cdh.extra_field.data(), cdh.extra_field_length);
+        WRITE_BINARY_PTR(stream, extra_field.data(), extra_field_length);
     }
     if (cdh.file_comment_length > 0)
     {
@@ -266,23 +442,94 @@ void write_central_directory_header(std::ostream& stream, const CentralDirectory
     }
 }
 
-static constexpr uint32_t get_central_directory_header_size(const CentralDirectoryHeader& cdh)
+static uint64_t get_central_directory_header_size(const CentralDirectoryHeader& cdh)
+{
+    return 46U + cdh.file_name_length + get_central_directory_header_extra_field(cdh).size() + cdh.file_comment_length;
+}
+
+static Zip64EndOfCentralDirectoryLocator read_zip64_end_of_central_directory_locator(std::istream& stream)
+{
+    Zip64EndOfCentralDirectoryLocator locator;
+
+    READ_BINARY(stream, locator.signature);
+    READ_BINARY(stream, locator.disk_start_number);
+    READ_BINARY(stream, locator.offset);
+    READ_BINARY(stream, locator.disk_count);
+
+    return locator;
+}
+
+static void write_zip64_end_of_central_directory_locator(std::ostream& stream, const Zip64EndOfCentralDirectoryLocator& locator)
+{
+    WRITE_BINARY(stream, locator.signature);
+    WRITE_BINARY(stream, locator.disk_start_number);
+    WRITE_BINARY(stream, locator.offset);
+    WRITE_BINARY(stream, locator.disk_count);
+}
+
+static constexpr uint64_t get_zip64_end_of_central_directory_locator_size()
+{
+    return 20U;
+}
+
+static Zip64EndOfCentralDirectoryRecord read_zip64_end_of_central_directory_record(std::istream& stream)
+{
+    Zip64EndOfCentralDirectoryRecord eocd64;
+
+    READ_BINARY(stream, eocd64.signature);
+    READ_BINARY(stream, eocd64.record_size);
+    READ_BINARY(stream, eocd64.version_made_by);
+    READ_BINARY(stream, eocd64.version_to_extract);
+    READ_BINARY(stream, eocd64.disk_number);
+    READ_BINARY(stream, eocd64.disk_start_number);
+    READ_BINARY(stream, eocd64.directory_record_number_disk);
+    READ_BINARY(stream, eocd64.directory_record_number);
+    READ_BINARY(stream, eocd64.central_directory_size);
+    READ_BINARY(stream, eocd64.offset);
+
+    Lud::check::that(
+        eocd64.signature == Signatures::ZIP64_END_OF_CENTRAL_DIRECTORY_RECORD,
+        "Incorrect zip64 EOCD signature"
+    );
+
+    return eocd64;
+}
+
+static void write_zip64_end_of_central_directory_record(std::ostream& stream, const Zip64EndOfCentralDirectoryRecord& eocd64)
+{
+    WRITE_BINARY(stream, eocd64.signature);
+    WRITE_BINARY(stream, eocd64.record_size);
+    WRITE_BINARY(stream, eocd64.version_made_by);
+    WRITE_BINARY(stream, eocd64.version_to_extract);
+    WRITE_BINARY(stream, eocd64.disk_number);
+    WRITE_BINARY(stream, eocd64.disk_start_number);
+    WRITE_BINARY(stream, eocd64.directory_record_number_disk);
+    WRITE_BINARY(stream, eocd64.directory_record_number);
+    WRITE_BINARY(stream, eocd64.central_directory_size);
+    WRITE_BINARY(stream, eocd64.offset);
+}
+
+static constexpr uint64_t get_zip64_end_of_central_directory_record_size()
 {
-    return 46U + cdh.file_name_length + cdh.extra_field_length + cdh.file_comment_length;
+    return 56U;
 }
 
 static EndOfCentralDirectoryRecord read_end_of_central_directory_record(std::istream& stream)
 {
-    const size_t begin_size = stream.tellg();
+    const uint64_t begin_size = stream.tellg();
     EndOfCentralDirectoryRecord eocd;
+    uint16_t directory_record_number_disk;
+    uint16_t directory_record_number;
+    uint32_t central_directory_size;
+    uint32_t offset;
 
     READ_BINARY(stream, eocd.signature);
     READ_BINARY(stream, eocd.disk_number);
     READ_BINARY(stream, eocd.disk_start_number);
-    READ_BINARY(stream, eocd.directory_record_number);
-    READ_BINARY(stream, eocd.directory_record_number_disk);
-    READ_BINARY(stream, eocd.central_directory_size);
-    READ_BINARY(stream, eocd.offset);
+    READ_BINARY(stream, directory_record_number);
+    READ_BINARY(stream, directory_record_number_disk);
+    READ_BINARY(stream, central_directory_size);
+    READ_BINARY(stream, offset);
     READ_BINARY(stream, eocd.comment_length);
 
     if (eocd.comment_length > 0)
@@ -291,10 +538,33 @@ static EndOfCentralDirectoryRecord read_end_of_central_directory_record(std::ist
         READ_BINARY_PTR(stream, eocd.comment.data(), eocd.comment_length);
     }
 
+    eocd.directory_record_number_disk = directory_record_number_disk;
+    eocd.directory_record_number = directory_record_number;
+    eocd.central_directory_size = central_directory_size;
+    eocd.offset = offset;
+
     const auto current_pos = stream.tellg();
-    stream.seekg(static_cast<std::streamoff>(eocd.offset), std::ios::beg);
-    uint32_t cdh_signature;
-    READ_BINARY(stream, cdh_signature);
+
+    // the central directory ends where the zip64 EOCD begins if there is one
+    uint64_t central_directory_end = begin_size;
+    if (begin_size >= get_zip64_end_of_central_directory_locator_size())
+    {
+        stream.seekg(static_cast<std::streamoff>(begin_size - get_zip64_end_of_central_directory_locator_size()), std::ios::beg);
+        const auto locator = read_zip64_end_of_central_directory_locator(stream);
+        if (locator.signature == Signatures::ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR)
+        {
+            stream.seekg(static_cast<std::streamoff>(locator.offset), std::ios::beg);
+            const auto eocd64 = read_zip64_end_of_central_directory_record(stream);
+
+            eocd.directory_record_number_disk = eocd64.directory_record_number_disk;
+            eocd.directory_record_number = eocd64.directory_record_number;
+            eocd.central_directory_size = eocd64.central_directory_size;
+            eocd.offset = eocd64.offset;
+            central_directory_end = locator.offset;
+        }
+        stream.clear();
+    }
+
     stream.seekg(current_pos, std::ios::beg);
 
     Lud::check::that(
@@ -303,12 +573,7 @@ static EndOfCentralDirectoryRecord read_end_of_central_directory_record(std::ist
     );
 
     Lud::check::that(
-        cdh_signature == Signatures::CENTRAL_DIRECTORY_HEADER,
-        "EOCD offset does not point to central directory header"
-    );
-
-    Lud::check::that(
-        begin_size - eocd.offset == eocd.central_directory_size,
+        central_directory_end - eocd.offset == eocd.central_directory_size,
         "Incorrect EOCD directory size"
     );
 
@@ -317,13 +582,18 @@ static EndOfCentralDirectoryRecord read_end_of_central_directory_record(std::ist
 
 static void write_end_of_central_directory_record(std::ostream& stream, const EndOfCentralDirectoryRecord& eocd)
 {
+    const auto directory_record_number = static_cast<uint16_t>(std::min<uint64_t>(eocd.directory_record_number, ZIP64_LIMIT_16));
+    const auto directory_record_number_disk = static_cast<uint16_t>(std::min<uint64_t>(eocd.directory_record_number_disk, ZIP64_LIMIT_16));
+    const auto central_directory_size = static_cast<uint32_t>(std::min<uint64_t>(eocd.central_directory_size, ZIP64_LIMIT));
+    const auto offset = static_cast<uint32_t>(std::min<uint64_t>(eocd.offset, ZIP64_LIMIT));
+
     WRITE_BINARY(stream, eocd.signature);
     WRITE_BINARY(stream, eocd.disk_number);
     WRITE_BINARY(stream, eocd.disk_start_number);
-    WRITE_BINARY(stream, eocd.directory_record_number);
-    WRITE_BINARY(stream, eocd.directory_record_number_disk);
-    WRITE_BINARY(stream, eocd.central_directory_size);
-    WRITE_BINARY(stream, eocd.offset);
+    WRITE_BINARY(stream, directory_record_number);
+    WRITE_BINARY(stream, directory_record_number_disk);
+    WRITE_BINARY(stream, central_directory_size);
+    WRITE_BINARY(stream, offset);
     WRITE_BINARY(stream, eocd.comment_length);
 
     if (eocd.comment_length > 0)
@@ -332,7 +602,7 @@ static void write_end_of_central_directory_record(std::ostream& stream, const En
     }
 }
 
-static DataDescriptor read_data_descriptor(std::istream& stream)
+static DataDescriptor read_data_descriptor(std::istream& stream, bool zip64)
 {
     DataDescriptor dd;
     READ_BINARY(stream, dd.CRC_32);
@@ -341,219 +611,698 @@ static DataDescriptor read_data_descriptor(std::istream& stream)
         dd.optional_signature = dd.CRC_32;
         READ_BINARY(stream, dd.CRC_32);
     }
-    READ_BINARY(stream, dd.compressed_size);
-    READ_BINARY(stream, dd.uncompressed_size);
+    if (zip64)
+    {
+        READ_BINARY(stream, dd.compressed_size);
+        READ_BINARY(stream, dd.uncompressed_size);
+    }
+    else
+    {
+        uint32_t compressed_size;
+        uint32_t uncompressed_size;
+        READ_BINARY(stream, compressed_size);
+        READ_BINARY(stream, uncompressed_size);
+        dd.compressed_size = compressed_size;
+        dd.uncompressed_size = uncompressed_size;
+    }
 
     return dd;
 }
 
+static void write_data_descriptor(std::ostream& stream, const DataDescriptor& dd, bool zip64)
+{
+    WRITE_BINARY(stream, dd.optional_signature);
+    WRITE_BINARY(stream, dd.CRC_32);
+    if (zip64)
+    {
+        WRITE_BINARY(stream, dd.compressed_size);
+        WRITE_BINARY(stream, dd.uncompressed_size);
+    }
+    else
+    {
+        const auto compressed_size = static_cast<uint32_t>(dd.compressed_size);
+        const auto uncompressed_size = static_cast<uint32_t>(dd.uncompressed_size);
+        WRITE_BINARY(stream, compressed_size);
+        WRITE_BINARY(stream, uncompressed_size);
+    }
+}
+
+static CentralDirectoryHeader make_central_directory_header(const LocalFileHeader& lfh, uint64_t offset)
+{
+    return {
+        .signature = Signatures::CENTRAL_DIRECTORY_HEADER,
+        .version_made_by = 0,
+        .version_to_extract = 2,
+        .gen_purpose_flag = lfh.gen_purpose_flag,
+        .compression_method = lfh.compression_method,
+        .file_last_modification_time = 0,
+        .file_last_modification_date = 0,
+        .CRC_32 = lfh.CRC_32,
+        .compressed_size = lfh.compressed_size,
+        .uncompressed_size = lfh.uncompressed_size,
+        .file_name_length = lfh.file_name_length,
+        .extra_field_length = 0,
+        .file_comment_length = 0,
+        .disk_start = 0,
+        .internal_file_attrib = 0,
+        .external_file_attrib = 0,
+        .offset = offset,
+        .file_name = lfh.file_name,
+    };
+}
+
+static void write_central_directory(std::ostream& stream, const std::vector<CentralDirectoryHeader>& central_directory, uint64_t offset)
+{
+    uint64_t central_directory_size = 0;
+    for (const auto& directory : central_directory)
+    {
+        write_central_directory_header(stream, directory);
+        central_directory_size += get_central_directory_header_size(directory);
+    }
+
+    const bool zip64 = central_directory.size() >= ZIP64_LIMIT_16
+                    || central_directory_size >= ZIP64_LIMIT
+                    || offset >= ZIP64_LIMIT;
+    if (zip64)
+    {
+        const Zip64EndOfCentralDirectoryRecord eocd64{
+            .signature = Signatures::ZIP64_END_OF_CENTRAL_DIRECTORY_RECORD,
+            // does not include the signature nor the size itself
+            .record_size = get_zip64_end_of_central_directory_record_size() - 12,
+            .version_made_by = ZIP64_VERSION,
+            .version_to_extract = ZIP64_VERSION,
+            .disk_number = 0,
+            .disk_start_number = 0,
+            .directory_record_number_disk = central_directory.size(),
+            .directory_record_number = central_directory.size(),
+            .central_directory_size = central_directory_size,
+            .offset = offset,
+        };
+        write_zip64_end_of_central_directory_record(stream, eocd64);
+
+        const Zip64EndOfCentralDirectoryLocator locator{
+            .signature = Signatures::ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR,
+            .disk_start_number = 0,
+            .offset = offset + central_directory_size,
+            .disk_count = 1,
+        };
+        write_zip64_end_of_central_directory_locator(stream, locator);
+    }
+
+    EndOfCentralDirectoryRecord eocd{
+        .signature = Signatures::END_OF_CENTRAL_DIRECTORY_RECORD,
+        .disk_number = 0,
+        .disk_start_number = 0,
+        .directory_record_number_disk = central_directory.size(),
+        .directory_record_number = central_directory.size(),
+        .central_directory_size = central_directory_size,
+        .offset = offset,
+        .comment_length = 0
+    };
+
+    write_end_of_central_directory_record(stream, eocd);
+}
+
+// memrchr is vectorized in glibc, elsewhere std::find is expected to be
+static const uint8_t* find_last_byte(std::span<const uint8_t> data, uint8_t byte)
+{
+#ifdef __GLIBC__
+    return static_cast<const uint8_t*>(memrchr(data.data(), byte, data.size()));
+#else
+    const auto it = std::find(data.rbegin(), data.rend(), byte);
+    return it == data.rend() ? nullptr : std::to_address(std::prev(it.base()));
+#endif
+}
+
 static size_t find_eocd_size_from_zip(std::istream& stream)
 {
-    // find a signature 0x06054b50
-    // advance 16 Bytes to get "offset" to start of central directory (from begginig of file)
-    // check if offsset is signature of central directory header 0x02014b50
+    // find a signature 0x06054b50 in the tail of the file
     // check that the EOCD ends at EOF
+    // check that the central directory ends before the EOCD
+    //     unless the values are set to the zip64 limit, then the zip64 EOCD has the real ones
+    // check the central directory signature if it is inside the tail
     stream.seekg(0, std::ios::end);
-    const size_t file_size = stream.tellg();
-    // 22 is base eocd size
-    constexpr size_t max_eocd_size = 0xFFFF + 22;
-    const size_t search_size = std::min(max_eocd_size, file_size);
-
-    // starts at the end - base EOCD size, iterates until min(max_uint16_t, file_size) + base EOCD size
+    const uint64_t file_size = stream.tellg();
     constexpr size_t eocd_size = 22;
-    const auto loop_end = static_cast<std::streamoff>(file_size - search_size);
-    const auto loop_begin = static_cast<std::streamoff>(file_size - eocd_size);
+    constexpr size_t max_eocd_size = 0xFFFF + eocd_size;
+    const auto search_size = static_cast<size_t>(std::min<uint64_t>(max_eocd_size, file_size));
+    const uint64_t tail_offset = file_size - search_size;
+
+    // the whole tail is read once, candidates are validated from the buffer
+    std::vector<uint8_t> tail(search_size);
+    stream.seekg(static_cast<std::streamoff>(tail_offset));
+    READ_BINARY_PTR(stream, tail.data(), tail.size());
+    Lud::check::that(stream.good(), "unable to read zip end of central directory");
+
+    const auto read_field = [&]<typename T>(size_t pos, T& value) {
+        std::memcpy(&value, tail.data() + pos, sizeof(value));
+    };
+
+    constexpr uint32_t eocd_signature = Signatures::END_OF_CENTRAL_DIRECTORY_RECORD;
+    constexpr uint32_t cd_signature = Signatures::CENTRAL_DIRECTORY_HEADER;
+    constexpr auto signature_last_byte = static_cast<uint8_t>(eocd_signature >> 24);
 
-    for (std::streamoff i = loop_begin; i >= loop_end; --i)
+    // searches for the last byte of the signature, a full EOCD has to fit after its start
+    size_t search_end = search_size >= eocd_size ? search_size - eocd_size + sizeof(eocd_signature) : 0;
+    while (const uint8_t* found = find_last_byte({tail.data(), search_end}, signature_last_byte))
     {
-        stream.seekg(i);
+        search_end = found - tail.data();
+        if (search_end < sizeof(eocd_signature) - 1)
+        {
+            break;
+        }
+        const size_t pos = search_end - (sizeof(eocd_signature) - 1);
+
         uint32_t signature;
-        READ_BINARY(stream, signature);
-        if (signature == Signatures::END_OF_CENTRAL_DIRECTORY_RECORD)
+        read_field(pos, signature);
+        if (signature != eocd_signature)
         {
-            // 16 is eocd start offset
-            stream.seekg(i + 16);
-            uint32_t offset;
-            READ_BINARY(stream, offset);
-            stream.seekg(offset);
+            continue;
+        }
 
-            uint32_t dir_sig;
-            READ_BINARY(stream, dir_sig);
+        // 20 is comment_l_offset
+        uint16_t comment_sz;
+        read_field(pos + 20, comment_sz);
+        // eocd not at the end of file
+        if (pos + eocd_size + comment_sz != search_size)
+        {
+            continue;
+        }
 
-            if (dir_sig != Signatures::CENTRAL_DIRECTORY_HEADER)
+        // 12 is central directory size offset, 16 is central directory offset
+        uint32_t cd_size;
+        uint32_t cd_offset;
+        read_field(pos + 12, cd_size);
+        read_field(pos + 16, cd_offset);
+        const uint64_t eocd_offset = tail_offset + pos;
+        if (cd_size != ZIP64_LIMIT && cd_offset != ZIP64_LIMIT)
+        {
+            if (uint64_t{cd_offset} + cd_size > eocd_offset)
             {
                 continue;
             }
-            // 20 is comment_l_offset
-            stream.seekg(i + 20);
-            uint16_t comment_sz;
-            READ_BINARY(stream, comment_sz);
-            // eocd not at the end of file
-            if (i + eocd_size + comment_sz != file_size)
+            if (cd_size != 0 && cd_offset >= tail_offset)
             {
-                continue;
+                uint32_t dir_sig;
+                read_field(cd_offset - tail_offset, dir_sig);
+                if (dir_sig != cd_signature)
+                {
+                    continue;
+                }
             }
-            return eocd_size + comment_sz;
         }
+        return eocd_size + comment_sz;
     }
     // should never happen
     throw std::runtime_error("unable to find EOCD");
 }
 
-struct ZipArchive::Impl
+static LocalFileHeader make_local_file_header(CentralDirectoryHeader&& cdh)
 {
-    struct file_entry
-    {
-        LocalFileHeader header;
-        std::vector<uint8_t> compressed_data;
+    Lud::check::in(
+        cdh.compression_method,
+        {CompressionMethod::DEFLATE, CompressionMethod::NONE},
+        "Unknown compression method"
+    );
+
+    Lud::check::that(
+        cdh.compression_method != CompressionMethod::NONE || cdh.compressed_size == cdh.uncompressed_size,
+        "Stored entry sizes do not match"
+    );
+
+    // the central directory is used instead of the local file header as
+    // entries written with a data descriptor have no sizes nor crc in it
+    return {
+        .signature = Signatures::LOCAL_FILE_HEADER,
+        .version = cdh.version_to_extract,
+        .gen_purpose_flag = static_cast<uint16_t>(cdh.gen_purpose_flag & ~GeneralPurposeFlags::DATA_DESCRIPTOR),
+        .compression_method = cdh.compression_method,
+        .file_last_modification_time = cdh.file_last_modification_time,
+        .file_last_modification_date = cdh.file_last_modification_date,
+        .CRC_32 = cdh.CRC_32,
+        .compressed_size = cdh.compressed_size,
+        .uncompressed_size = cdh.uncompressed_size,
+        .file_name_length = cdh.file_name_length,
+        .extra_field_length = 0,
+        .file_name = std::move(cdh.file_name),
     };
-    std::vector<file_entry> file_entries;
-};
+}
 
-ZipArchive::ZipArchive()
-    : p_impl(new Impl)
+static uint64_t find_local_file_data(std::istream& stream, uint64_t offset)
 {
+    stream.clear();
+    stream.seekg(static_cast<std::streamoff>(offset), std::ios::beg);
+    // only read to skip it, file name and extra field lengths might differ from the central directory
+    read_local_file_header(stream);
+
+    return stream.tellg();
 }
 
-ZipArchive::ZipArchive(std::istream& stream)
-    : ZipArchive()
+static void read_local_file_data(std::istream& stream, uint64_t offset, std::span<uint8_t> data)
 {
-    read(stream);
+    find_local_file_data(stream, offset);
+
+    READ_BINARY_PTR(stream, data.data(), data.size());
+
+    Lud::check::that(stream.good(), "Could not read entry data");
 }
 
-ZipArchive::~ZipArchive()
+static std::span<const uint8_t> find_local_file_data(std::span<const uint8_t> source, uint64_t offset, uint64_t size)
 {
-    delete p_impl;
-}
+    Lud::check::that(offset <= source.size(), "Could not read entry data");
+    _detail_::SpanReader reader(source.subspan(offset));
 
-// https://pkwaredownloads.blob.core.windows.net/pkware-general/Documentation/APPNOTE-6.3.9.TXT
+    uint32_t signature;
+    reader.Read(signature);
+    Lud::check::that(
+        signature == Signatures::LOCAL_FILE_HEADER,
+        std::format("Signature does not match, expected {:08X}, got {:08X}", Signatures::LOCAL_FILE_HEADER, signature));
+
+    // 22 bytes from the signature to the file name length
+    reader.ReadBytes(22);
+    uint16_t file_name_length;
+    uint16_t extra_field_length;
+    reader.Read(file_name_length);
+    reader.Read(extra_field_length);
+    reader.ReadBytes(size_t{file_name_length} + extra_field_length);
+
+    return reader.ReadBytes(size);
+}
 
-void ZipArchive::Push(const std::string_view name, std::istream& stream)
+struct ZipArchive::Impl
 {
-    auto uncompressed_data = slurp(stream);
+    struct file_entry
+    {
+        LocalFileHeader header;
+        std::vector<uint8_t> compressed_data;
+        // offset of the local file header in the source
+        uint64_t offset{};
+        // false if compressed_data has to be read from the source
+        bool loaded{true};
+        // the entry in the source is followed by a data descriptor
+        bool data_descriptor{false};
+    };
+    // slots do not move when entries are added or removed, the name index views their names
+    _detail_::SlotMap<file_entry> file_entries;
+    _detail_::NameIndex name_index;
 
-    p_impl->file_entries.emplace_back();
+    CompressionPolicy compression_policy;
 
-    auto& [lfh, compressed_data] = p_impl->file_entries.back();
+    // only set for lazily read archives
+    std::istream* source{nullptr};
+    std::mutex source_mutex;
 
-    // TODO: implement crc32
-    uint32_t crc = 0;
-    if (!uncompressed_data.empty())
-    {
-        // zlib recommends to set the buffer size to at least the uncompressed size
-        compressed_data.reserve(uncompressed_data.size());
+    // only set for archives opened from a path, entries are read from it instead of from source
+    std::unique_ptr<_detail_::MappedFile> mapping;
 
-        // scoped so sync is automatically called on destruction
-        {
-            Lud::vector_ostream vec_ostream(compressed_data);
-            Lud::deflate_ostream comp_ostream(vec_ostream, {.type = Lud::CompressionType::RAW});
+    // only set for archives opened for update, same stream as source
+    std::iostream* update_target{nullptr};
+    // where the archive in the source ends, changes are appended from there
+    // so the archive already in the source is never overwritten
+    uint64_t archive_end{0};
 
-            WRITE_BINARY_PTR(comp_ostream, uncompressed_data.data(), uncompressed_data.size());
-        }
-        if (compressed_data.size() >= uncompressed_data.size())
-        {
-            compressed_data = std::move(uncompressed_data);
-            lfh.compression_method = CompressionMethod::NONE;
-            lfh.uncompressed_size = compressed_data.size();
-            lfh.compressed_size = compressed_data.size();
-        }
-        else
-        {
-            lfh.compression_method = CompressionMethod::DEFLATE;
-            lfh.compressed_size = compressed_data.size();
-            lfh.uncompressed_size = uncompressed_data.size();
-        }
+    static file_entry make_entry(const std::string_view name, std::span<const uint8_t> uncompressed_data, const CompressionPolicy& policy);
+
+    static file_entry make_raw_entry(const std::string_view name, RawArchiveEntry&& raw);
+
+    void add_entry(file_entry&& entry);
+
+    file_entry remove_entry(const ArchiveEntry& entry);
+
+    file_entry& get_entry(const ArchiveEntry& entry);
+
+    ArchiveEntry make_archive_entry(size_t index) const;
+
+    std::span<const uint8_t> get_compressed_data(const file_entry& entry, std::vector<uint8_t>& buffer);
+
+    std::span<uint8_t> decompress(const file_entry& entry, std::span<uint8_t> output);
+};
+
+ZipArchive::Impl::file_entry ZipArchive::Impl::make_entry(const std::string_view name, std::span<const uint8_t> uncompressed_data, const CompressionPolicy& policy)
+{
+    RawArchiveEntry raw{
+        .compressed_data = {},
+        .compression = archive_compression::none,
+        .crc = _detail_::crc32(uncompressed_data),
+        .uncompressed_size = uncompressed_data.size(),
+    };
+
+    const bool deflate = _detail_::choose_compression(name, uncompressed_data, policy) == archive_compression::deflate;
+    if (deflate && _detail_::deflate_raw(uncompressed_data, policy.level, raw.compressed_data))
+    {
+        raw.compression = archive_compression::deflate;
     }
     else
     {
-        lfh.compression_method = CompressionMethod::NONE;
-        lfh.uncompressed_size = compressed_data.size();
-        lfh.compressed_size = compressed_data.size();
+        raw.compressed_data.assign(uncompressed_data.begin(), uncompressed_data.end());
     }
+
+    return make_raw_entry(name, std::move(raw));
+}
+
+ZipArchive::Impl::file_entry ZipArchive::Impl::make_raw_entry(const std::string_view name, RawArchiveEntry&& raw)
+{
+    Lud::check::in(
+        raw.compression,
+        {archive_compression::deflate, archive_compression::none},
+        "Unknown compression method"
+    );
+    Lud::check::that(
+        raw.compression != archive_compression::none || raw.compressed_data.size() == raw.uncompressed_size,
+        "Stored entry sizes do not match"
+    );
+
+    file_entry entry;
+    auto& lfh = entry.header;
+
     lfh.signature = Signatures::LOCAL_FILE_HEADER;
     lfh.version = 2; // means compressed with deflate
     lfh.gen_purpose_flag = 0;
+    lfh.compression_method = raw.compression == archive_compression::deflate ? CompressionMethod::DEFLATE : CompressionMethod::NONE;
     lfh.file_last_modification_time = 0; // get epoch time
     lfh.file_last_modification_date = 0; // get epoch time
-    lfh.CRC_32 = crc;
+    lfh.CRC_32 = raw.crc;
+    lfh.compressed_size = raw.compressed_data.size();
+    lfh.uncompressed_size = raw.uncompressed_size;
     lfh.file_name_length = name.size();
     lfh.extra_field_length = 0;
     lfh.file_name = name;
+    entry.compressed_data = std::move(raw.compressed_data);
+
+    return entry;
 }
 
-std::vector<uint8_t> ZipArchive::Peek(const ArchiveEntry& entry) const
+void ZipArchive::Impl::add_entry(file_entry&& entry)
 {
-    auto& entries = p_impl->file_entries;
-
-    auto& [lfh, compressed_data] = entries[entry.index];
-    std::vector<uint8_t> uncompressed_data;
-    uncompressed_data.resize(lfh.uncompressed_size);
-    if (lfh.compression_method == CompressionMethod::NONE)
-    {
-        std::copy_n(compressed_data.begin(), lfh.uncompressed_size, uncompressed_data.begin());
-    }
-    else
-    {
-        Lud::memory_istream<uint8_t> mem_stream(compressed_data);
-        Lud::inflate_istream inflate_stream(mem_stream, {.type = Lud::CompressionType::RAW});
+    const size_t index = file_entries.Insert(std::move(entry));
+    name_index.Insert(file_entries[index].header.file_name, index);
+}
 
-        READ_BINARY_PTR(inflate_stream, uncompressed_data.data(), uncompressed_data.size());
-    }
+ZipArchive::Impl::file_entry ZipArchive::Impl::remove_entry(const ArchiveEntry& entry)
+{
+    auto& file_entry = get_entry(entry);
 
-    // Lud::check::eq(
-    //     lfh.CRC_32,
-    //     crc32(0, uncompressed_data.data(), lfh.uncompressed_size),
-    //     std::format("File: [{}] is corrupted and can not be recovered", lfh.file_name));
+    // erased before the entry is moved, the key views its name
+    name_index.Erase(file_entry.header.file_name, entry.index);
+    auto removed = std::move(file_entry);
+    file_entries.Erase(entry.index);
 
-    return uncompressed_data;
+    return removed;
 }
 
-std::vector<ArchiveEntry> ZipArchive::GetDirectory() const
+ZipArchive::Impl::file_entry& ZipArchive::Impl::get_entry(const ArchiveEntry& entry)
 {
-    std::vector<ArchiveEntry> directory;
+    Lud::check::that(file_entries.Contains(entry.index, entry.generation), "Entry is not in the archive");
 
-    const auto& entries = p_impl->file_entries;
+    return file_entries[entry.index];
+}
+
+ArchiveEntry ZipArchive::Impl::make_archive_entry(size_t index) const
+{
+    const auto& header = file_entries[index].header;
+    return {
+        header.file_name,
+        index,
+        file_entries.GetGeneration(index),
+        header.uncompressed_size,
+        header.compressed_size,
+    };
+}
 
-    directory.reserve(entries.size());
-    for (size_t i = 0; i < entries.size(); i++)
+std::span<const uint8_t> ZipArchive::Impl::get_compressed_data(const file_entry& entry, std::vector<uint8_t>& buffer)
+{
+    if (entry.loaded)
     {
-        directory.emplace_back(
-            entries[i].header.file_name,
-            i,
-            entries[i].header.uncompressed_size,
-            entries[i].header.compressed_size
-        );
+        return entry.compressed_data;
     }
-    return directory;
+    if (mapping)
+    {
+        const auto data = find_local_file_data(mapping->GetData(), entry.offset, entry.header.compressed_size);
+        if (data.size() >= _detail_::STREAM_WINDOW_SIZE)
+        {
+            mapping->WillNeed(data);
+        }
+        return data;
+    }
+
+    // the buffer only grows, so reusing it for many entries does not allocate every time
+    if (buffer.size() < entry.header.compressed_size)
+    {
+        buffer.resize(entry.header.compressed_size);
+    }
+    const auto data = std::span(buffer).first(entry.header.compressed_size);
+
+    std::scoped_lock lock(source_mutex);
+    read_local_file_data(*source, entry.offset, data);
+
+    return data;
 }
 
-std::vector<uint8_t> ZipArchive::Pop(const ArchiveEntry& entry)
+std::span<uint8_t> ZipArchive::Impl::decompress(const file_entry& entry, std::span<uint8_t> output)
 {
-    auto& file_entries = p_impl->file_entries;
-
-    auto& file_entry_to_remove = file_entries[entry.index];
+    const auto& lfh = entry.header;
+    Lud::check::that(
+        output.size() >= lfh.uncompressed_size,
+        std::format("File: [{}] does not fit in the output", lfh.file_name));
 
-    file_entries.erase(file_entries.begin() + static_cast<ptrdiff_t>(entry.index));
+    std::vector<uint8_t> buffer;
+    const auto compressed_data = get_compressed_data(entry, buffer);
 
-    auto& [lfh, compressed_data] = file_entry_to_remove;
-    std::vector<uint8_t> uncompressed_data;
-    uncompressed_data.resize(lfh.uncompressed_size);
+    const auto uncompressed_data = output.first(lfh.uncompressed_size);
     if (lfh.compression_method == CompressionMethod::NONE)
     {
         std::copy_n(compressed_data.begin(), lfh.uncompressed_size, uncompressed_data.begin());
     }
     else
     {
-        Lud::memory_istream<uint8_t> mem_stream(compressed_data);
-        Lud::inflate_istream inflate_stream(mem_stream, {.type = Lud::CompressionType::RAW});
+        Lud::check::that(
+            _detail_::inflate_raw(compressed_data, uncompressed_data),
+            std::format("File: [{}] is corrupted and can not be recovered", lfh.file_name));
+    }
+
+#ifdef VARF_DO_CRC_32
+    Lud::check::eq(
+        lfh.CRC_32,
+        _detail_::crc32(uncompressed_data),
+        std::format("File: [{}] is corrupted and can not be recovered", lfh.file_name));
+#endif
+
+    return uncompressed_data;
+}
+
+ZipArchive::ZipArchive()
+    : p_impl(new Impl)
+{
+}
+
+ZipArchive::ZipArchive(std::istream& stream, ArchiveMode mode)
+    : ZipArchive()
+{
+    Lud::check::that(mode != archive_mode::update, "Update mode needs a stream that can be written");
+
+    read(stream, mode);
+}
+
+ZipArchive::ZipArchive(std::iostream& stream, ArchiveMode mode)
+    : ZipArchive()
+{
+    read(stream, mode);
+
+    if (mode == archive_mode::update)
+    {
+        p_impl->update_target = &stream;
+    }
+}
+
+ZipArchive::ZipArchive(const std::filesystem::path& path)
+    : ZipArchive()
+{
+    p_impl->mapping = std::make_unique<_detail_::MappedFile>(path);
+
+    Lud::memory_istream<uint8_t> stream(p_impl->mapping->GetData());
+    read(stream, archive_mode::lazy);
+}
+
+ZipArchive::~ZipArchive()
+{
+    delete p_impl;
+}
+
+// https://pkwaredownloads.blob.core.windows.net/pkware-general/Documentation/APPNOTE-6.3.9.TXT
+
+void ZipArchive::Push(const std::string_view name, std::istream& stream)
+{
+    p_impl->add_entry(Impl::make_entry(name, slurp(stream), p_impl->compression_policy));
+}
+
+void ZipArchive::PushMany(std::span<const ArchiveInput> inputs, unsigned int threads)
+{
+    std::vector<Impl::file_entry> entries(inputs.size());
+
+    _detail_::parallel_for(inputs.size(), threads, [&](size_t i) {
+        const auto& [name, data] = inputs[i];
+        if (const auto* stream = std::get_if<std::istream*>(&data))
+        {
+            entries[i] = Impl::make_entry(name, slurp(**stream), p_impl->compression_policy);
+        }
+        else
+        {
+            entries[i] = Impl::make_entry(name, std::get<std::span<const uint8_t>>(data), p_impl->compression_policy);
+        }
+    });
+
+    for (auto& entry : entries)
+    {
+        p_impl->add_entry(std::move(entry));
+    }
+}
+
+void ZipArchive::SetCompressionPolicy(CompressionPolicy policy)
+{
+    p_impl->compression_policy = std::move(policy);
+}
+
+void ZipArchive::PushRaw(const std::string_view name, RawArchiveEntry entry)
+{
+    p_impl->add_entry(Impl::make_raw_entry(name, std::move(entry)));
+}
+
+RawArchiveEntry ZipArchive::PeekRaw(const ArchiveEntry& entry) const
+{
+    const auto& file_entry = p_impl->get_entry(entry);
+    const auto& lfh = file_entry.header;
+
+    std::vector<uint8_t> buffer;
+    const auto compressed_data = p_impl->get_compressed_data(file_entry, buffer);
+    // lazily read entries are read straight into the buffer
+    if (compressed_data.data() != buffer.data())
+    {
+        buffer.assign(compressed_data.begin(), compressed_data.end());
+    }
+
+    return {
+        .compressed_data = std::move(buffer),
+        .compression = lfh.compression_method == CompressionMethod::DEFLATE ? archive_compression::deflate : archive_compression::none,
+        .crc = lfh.CRC_32,
+        .uncompressed_size = lfh.uncompressed_size,
+    };
+}
+
+std::vector<uint8_t> ZipArchive::Peek(const ArchiveEntry& entry) const
+{
+    const auto& file_entry = p_impl->get_entry(entry);
+
+    std::vector<uint8_t> uncompressed_data(file_entry.header.uncompressed_size);
+    p_impl->decompress(file_entry, uncompressed_data);
+
+    return uncompressed_data;
+}
+
+std::span<uint8_t> ZipArchive::Peek(const ArchiveEntry& entry, std::span<uint8_t> output) const
+{
+    return p_impl->decompress(p_impl->get_entry(entry), output);
+}
+
+std::span<const uint8_t> ZipArchive::View(const ArchiveEntry& entry, std::vector<uint8_t>& scratch) const
+{
+    const auto& file_entry = p_impl->get_entry(entry);
+    const auto& lfh = file_entry.header;
+
+    if (lfh.compression_method != CompressionMethod::NONE)
+    {
+        return Peek(entry, scratch);
+    }
+
+    // stored entries already are their data, lazily read ones are read straight into scratch
+    const auto data = p_impl->get_compressed_data(file_entry, scratch).first(lfh.uncompressed_size);
+
+#ifdef VARF_DO_CRC_32
+    Lud::check::eq(
+        lfh.CRC_32,
+        _detail_::crc32(data),
+        std::format("File: [{}] is corrupted and can not be recovered", lfh.file_name));
+#endif
+
+    return data;
+}
+
+std::unique_ptr<std::istream> ZipArchive::Open(const ArchiveEntry& entry) const
+{
+    const auto& file_entry = p_impl->get_entry(entry);
+    const auto& lfh = file_entry.header;
+    const bool deflated = lfh.compression_method == CompressionMethod::DEFLATE;
+
+    if (file_entry.loaded)
+    {
+        return std::make_unique<_detail_::EntryIstream>(
+            std::make_unique<_detail_::SpanStreambuf>(file_entry.compressed_data),
+            deflated,
+            lfh.CRC_32
+        );
+    }
+
+    if (p_impl->mapping)
+    {
+        // mapped entries are viewed in place, the buffer is not used
+        std::vector<uint8_t> unused;
+        return std::make_unique<_detail_::EntryIstream>(
+            std::make_unique<_detail_::SpanStreambuf>(p_impl->get_compressed_data(file_entry, unused)),
+            deflated,
+            lfh.CRC_32
+        );
+    }
+
+    uint64_t data_offset = 0;
+    {
+        std::scoped_lock lock(p_impl->source_mutex);
+        data_offset = find_local_file_data(*p_impl->source, file_entry.offset);
+    }
+
+    return std::make_unique<_detail_::EntryIstream>(
+        std::make_unique<_detail_::SourceStreambuf>(*p_impl->source, p_impl->source_mutex, data_offset, lfh.compressed_size),
+        deflated,
+        lfh.CRC_32
+    );
+}
+
+std::optional<ArchiveEntry> ZipArchive::Find(const std::string_view name) const
+{
+    const auto index = p_impl->name_index.Find(name);
+    if (!index)
+    {
+        return std::nullopt;
+    }
+
+    return p_impl->make_archive_entry(*index);
+}
+
+std::vector<ArchiveEntry> ZipArchive::GetDirectory() const
+{
+    std::vector<ArchiveEntry> directory;
+
+    const auto& entries = p_impl->file_entries;
 
-        READ_BINARY_PTR(inflate_stream, uncompressed_data.data(), uncompressed_data.size());
+    directory.reserve(entries.GetSize());
+    for (size_t i = 0; i < entries.GetSlotCount(); i++)
+    {
+        if (entries.IsAlive(i))
+        {
+            directory.emplace_back(p_impl->make_archive_entry(i));
+        }
     }
+    return directory;
+}
+
+std::vector<uint8_t> ZipArchive::Pop(const ArchiveEntry& entry)
+{
+    auto uncompressed_data = Peek(entry);
+
+    p_impl->remove_entry(entry);
 
     return uncompressed_data;
 }
 
-void ZipArchive::read(std::istream& stream)
+void ZipArchive::read(std::istream& stream, ArchiveMode mode)
 {
     auto eocd_size = static_cast<std::streamoff>(find_eocd_size_from_zip(stream));
 
@@ -562,23 +1311,60 @@ void ZipArchive::read(std::istream& stream)
     auto& entries = p_impl->file_entries;
     auto eocd = read_end_of_central_directory_record(stream);
 
-    stream.seekg(eocd.offset);
+    // the whole directory is read at once and parsed from memory
+    std::vector<uint8_t> buffer;
+    std::span<const uint8_t> central_directory;
+    if (p_impl->mapping)
+    {
+        const auto data = p_impl->mapping->GetData();
+        Lud::check::that(
+            eocd.offset <= data.size() && eocd.central_directory_size <= data.size() - eocd.offset,
+            "Could not read central directory");
+        central_directory = data.subspan(eocd.offset, eocd.central_directory_size);
+        p_impl->mapping->WillNeed(central_directory);
+    }
+    else
+    {
+        buffer.resize(eocd.central_directory_size);
+        stream.seekg(static_cast<std::streamoff>(eocd.offset), std::ios::beg);
+        READ_BINARY_PTR(stream, buffer.data(), buffer.size());
+        Lud::check::that(stream.good(), "Could not read central directory");
+        central_directory = buffer;
+    }
+
+    _detail_::SpanReader reader(central_directory);
 
     for (size_t i = 0; i < eocd.directory_record_number; i++)
     {
-        auto cdh = read_central_directory_header(stream);
-        const auto current_pos = stream.tellg();
-        stream.seekg(static_cast<std::streamoff>(cdh.offset));
+        auto cdh = read_central_directory_header(reader);
+
+        const auto offset = cdh.offset;
+        const bool data_descriptor = cdh.gen_purpose_flag & GeneralPurposeFlags::DATA_DESCRIPTOR;
+        p_impl->add_entry({
+            .header = make_local_file_header(std::move(cdh)),
+            .compressed_data = {},
+            .offset = offset,
+            .loaded = false,
+            .data_descriptor = data_descriptor,
+        });
+    }
+    stream.seekg(0, std::ios::end);
+    p_impl->archive_end = static_cast<uint64_t>(stream.tellg());
 
-        auto lfh = read_local_file_header(stream);
-        std::vector<uint8_t> compressed_data(lfh.compressed_size);
-        READ_BINARY_PTR(stream, compressed_data.data(), compressed_data.size());
-        stream.seekg(current_pos);
+    if (mode & archive_mode::lazy)
+    {
+        if (!p_impl->mapping)
+        {
+            p_impl->source = &stream;
+        }
+        return;
+    }
 
-        entries.emplace_back(
-            lfh,
-            std::move(compressed_data)
-        );
+    for (auto& entry : entries.Values())
+    {
+        entry.compressed_data.resize(entry.header.compressed_size);
+        read_local_file_data(stream, entry.offset, entry.compressed_data);
+        entry.loaded = true;
     }
 }
 
@@ -587,57 +1373,439 @@ void ZipArchive::Write(std::ostream& stream) const
     const auto& file_entries = p_impl->file_entries;
 
     std::vector<CentralDirectoryHeader> central_directory;
-    central_directory.reserve(file_entries.size());
-
-    uint32_t total_written = 0;
-    uint32_t central_directory_size = 0;
-
-    for (const auto& entry : file_entries)
-    {
-        central_directory.emplace_back(
-            Signatures::CENTRAL_DIRECTORY_HEADER,
-            0,
-            2,
-            0,
-            entry.header.compression_method,
-            0,
-            0,
-            entry.header.CRC_32,
-            entry.header.compressed_size,
-            entry.header.uncompressed_size,
-            entry.header.file_name_length,
-            0,
-            0,
-            0,
-            0,
-            0,
-            total_written,
-            entry.header.file_name
-        );
+    central_directory.reserve(file_entries.GetSize());
+
+    uint64_t total_written = 0;
+
+    std::vector<uint8_t> buffer;
+    for (const auto& entry : file_entries.Values())
+    {
+        central_directory.emplace_back(make_central_directory_header(entry.header, total_written));
+
+        const auto compressed_data = p_impl->get_compressed_data(entry, buffer);
 
         write_local_file_header(stream, entry.header);
-        WRITE_BINARY_PTR(stream, entry.compressed_data.data(), entry.compressed_data.size());
+        WRITE_BINARY_PTR(stream, compressed_data.data(), compressed_data.size());
 
         total_written += get_local_file_header_size(entry.header) + entry.header.compressed_size;
-        central_directory_size += get_central_directory_header_size(central_directory.back());
     }
-    for (const auto& directory : central_directory)
+
+    write_central_directory(stream, central_directory, total_written);
+}
+
+uint64_t ZipArchive::Commit()
+{
+    Lud::check::that(p_impl->update_target != nullptr, "Archive was not opened for update");
+
+    auto& stream = *p_impl->update_target;
+
+    std::vector<CentralDirectoryHeader> central_directory;
+    central_directory.reserve(p_impl->file_entries.GetSize());
+
+    // open streams read from the same stream
+    std::scoped_lock lock(p_impl->source_mutex);
+
+    stream.clear();
+    // a failed commit leaves the previous archive untouched before archive_end
+    stream.seekp(static_cast<std::streamoff>(p_impl->archive_end), std::ios::beg);
+
+    uint64_t total_written = p_impl->archive_end;
+    // new entries and where they were written, they are only changed once everything was written
+    std::vector<std::pair<Impl::file_entry*, uint64_t>> written_entries;
+    for (auto& entry : p_impl->file_entries.Values())
     {
-        write_central_directory_header(stream, directory);
+        uint64_t offset = entry.offset;
+        if (entry.loaded)
+        {
+            write_local_file_header(stream, entry.header);
+            WRITE_BINARY_PTR(stream, entry.compressed_data.data(), entry.compressed_data.size());
+
+            offset = total_written;
+            written_entries.emplace_back(&entry, offset);
+
+            total_written += get_local_file_header_size(entry.header) + entry.header.compressed_size;
+        }
+
+        auto& cdh = central_directory.emplace_back(make_central_directory_header(entry.header, offset));
+        if (entry.data_descriptor)
+        {
+            cdh.gen_purpose_flag |= GeneralPurposeFlags::DATA_DESCRIPTOR;
+        }
     }
 
-    EndOfCentralDirectoryRecord eocd{
-        .signature = Signatures::END_OF_CENTRAL_DIRECTORY_RECORD,
-        .disk_number = 0,
-        .disk_start_number = 0,
-        .directory_record_number_disk = static_cast<uint16_t>(central_directory.size()),
-        .directory_record_number = static_cast<uint16_t>(central_directory.size()),
-        .central_directory_size = central_directory_size,
-        .offset = total_written,
-        .comment_length = 0
+    write_central_directory(stream, central_directory, total_written);
+    stream.flush();
+
+    // if it failed the archive still holds the new entries and can be committed again
+    Lud::check::that(stream.good(), "Could not commit zip archive");
+    const auto archive_end = static_cast<uint64_t>(stream.tellp());
+
+    // from now on they are read from the stream like the rest
+    for (auto& [entry, offset] : written_entries)
+    {
+        entry->offset = offset;
+        entry->loaded = false;
+        entry->compressed_data = {};
+    }
+    p_impl->archive_end = archive_end;
+
+    return archive_end;
+}
+
+struct ZipWriter::Impl
+{
+    Impl(std::ostream& stream);
+
+    _detail_::CountingStreambuf counter;
+    std::ostream stream;
+
+    std::vector<CentralDirectoryHeader> central_directory;
+    bool finished{false};
+
+    void push(const std::string_view name, std::istream& input, std::optional<uint64_t> size);
+};
+
+ZipWriter::Impl::Impl(std::ostream& output)
+    : counter(output.rdbuf())
+    , stream(&counter)
+{
+}
+
+ZipWriter::ZipWriter(std::ostream& stream)
+    : p_impl(new Impl(stream))
+{
+}
+
+ZipWriter::~ZipWriter()
+{
+    try
+    {
+        Finish();
+    }
+    catch (...) // NOLINT
+    {
+        // destructors can not throw, call Finish to handle the error
+    }
+    delete p_impl;
+}
+
+void ZipWriter::Push(const std::string_view name, std::istream& stream)
+{
+    // the size is only used to choose between 32 and 64 bit records
+    std::optional<uint64_t> size;
+
+    const auto current_pos = stream.tellg();
+    if (current_pos != -1 && stream.seekg(0, std::ios::end))
+    {
+        size = static_cast<uint64_t>(stream.tellg() - current_pos);
+        stream.seekg(current_pos, std::ios::beg);
+    }
+    stream.clear();
+
+    p_impl->push(name, stream, size);
+}
+
+void ZipWriter::Push(const std::string_view name, std::span<const uint8_t> data)
+{
+    _detail_::SpanStreambuf buffer(data);
+    std::istream stream(&buffer);
+
+    p_impl->push(name, stream, data.size());
+}
+
+void ZipWriter::Impl::push(const std::string_view name, std::istream& input, std::optional<uint64_t> size)
+{
+    Lud::check::is_false(finished, "Can not push to a finished zip writer");
+
+    // same bound as zlib deflateBound, if the size is not known zip64 has to be used
+    const auto deflate_bound = [](uint64_t sz) {
+        return sz + (sz >> 12) + (sz >> 14) + (sz >> 25) + 13;
+    };
+    const bool zip64 = !size.has_value() || deflate_bound(*size) >= ZIP64_LIMIT;
+
+    LocalFileHeader lfh{
+        .signature = Signatures::LOCAL_FILE_HEADER,
+        .version = 2, // means compressed with deflate
+        .gen_purpose_flag = GeneralPurposeFlags::DATA_DESCRIPTOR,
+        .compression_method = CompressionMethod::DEFLATE,
+        .file_last_modification_time = 0,
+        .file_last_modification_date = 0,
+        .CRC_32 = 0,
+        .compressed_size = 0,
+        .uncompressed_size = 0,
+        .file_name_length = static_cast<uint16_t>(name.size()),
+        .extra_field_length = 0,
+        .file_name = std::string(name),
+        .zip64 = zip64,
     };
 
-    write_end_of_central_directory_record(stream, eocd);
+    const auto offset = counter.GetCount();
+    write_local_file_header(stream, lfh);
+
+    const auto data_begin = counter.GetCount();
+    uint64_t uncompressed_size = 0;
+    uint32_t crc = 0;
+    // scoped so sync is automatically called on destruction
+    {
+        Lud::deflate_ostream comp_ostream(stream, {.type = Lud::CompressionType::RAW});
+
+        std::vector<char> window(_detail_::STREAM_WINDOW_SIZE);
+        while (input)
+        {
+            input.read(window.data(), static_cast<std::streamsize>(window.size()));
+            const auto read = input.gcount();
+            if (read <= 0)
+            {
+                break;
+            }
+            comp_ostream.write(window.data(), read);
+            crc = _detail_::crc32({reinterpret_cast<const uint8_t*>(window.data()), static_cast<size_t>(read)}, crc);
+            uncompressed_size += read;
+        }
+    }
+    Lud::check::is_false(input.bad(), std::format("File: [{}] could not be read", name));
+
+    lfh.CRC_32 = crc;
+    lfh.compressed_size = counter.GetCount() - data_begin;
+    lfh.uncompressed_size = uncompressed_size;
+
+    Lud::check::that(zip64 || !is_zip64(lfh), "Zip entry is bigger than its stream size");
+
+    write_data_descriptor(stream, {
+        .optional_signature = Signatures::DATA_DESCRIPTOR,
+        .CRC_32 = lfh.CRC_32,
+        .compressed_size = lfh.compressed_size,
+        .uncompressed_size = lfh.uncompressed_size,
+    }, zip64);
+
+    Lud::check::that(stream.good(), "Could not write zip entry");
+
+    central_directory.emplace_back(make_central_directory_header(lfh, offset));
+}
+
+void ZipWriter::Finish()
+{
+    if (p_impl->finished)
+    {
+        return;
+    }
+    p_impl->finished = true;
+
+    write_central_directory(p_impl->stream, p_impl->central_directory, p_impl->counter.GetCount());
+    p_impl->stream.flush();
+}
+
+struct ZipStreamReader::Impl
+{
+    Impl(std::istream& stream);
+    ~Impl();
+
+    Impl(const Impl&) = delete;
+    Impl& operator=(const Impl&) = delete;
+    Impl(Impl&&) = delete;
+    Impl& operator=(Impl&&) = delete;
+
+    _detail_::ForwardStreambuf source;
+    // used to read headers and descriptors from the source
+    std::istream source_stream;
+
+    _detail_::PullStreambuf entry_buffer;
+    std::istream entry_stream;
+
+    z_stream inflater{};
+
+    LocalFileHeader header;
+    // only used for stored entries
+    uint64_t remaining{0};
+    uint64_t uncompressed_size{0};
+    uint32_t crc{0};
+    bool data_finished{true};
+    bool entry_finished{true};
+    bool ended{false};
+
+    bool next();
+
+    size_t read_data(std::span<char> output);
+
+    size_t inflate_data(std::span<char> output);
+
+    void finish_entry();
+};
+
+ZipStreamReader::Impl::Impl(std::istream& stream)
+    : source(stream)
+    , source_stream(&source)
+    , entry_buffer([this](std::span<char> output) { return read_data(output); })
+    , entry_stream(&entry_buffer)
+{
+    Lud::check::that(inflateInit2(&inflater, -MAX_WBITS) == Z_OK, "Could not initialize inflate");
+}
+
+ZipStreamReader::Impl::~Impl()
+{
+    inflateEnd(&inflater);
+}
+
+bool ZipStreamReader::Impl::next()
+{
+    if (ended)
+    {
+        return false;
+    }
+
+    // skips what was not read of the current entry
+    std::array<char, 0x1000> discard;
+    while (read_data(discard) > 0)
+    {
+    }
+    finish_entry();
+
+    entry_buffer.Reset();
+    entry_stream.clear();
+
+    // entries end where the central directory begins
+    const auto signature_data = source.Fill(sizeof(uint32_t));
+    uint32_t signature = 0;
+    if (signature_data.size() >= sizeof(signature))
+    {
+        std::memcpy(&signature, signature_data.data(), sizeof(signature));
+    }
+    if (signature != Signatures::LOCAL_FILE_HEADER)
+    {
+        ended = true;
+        return false;
+    }
+
+    header = read_local_file_header(source_stream);
+    Lud::check::that(source_stream.good(), "Unexpected end of zip stream");
+
+    const bool data_descriptor = header.gen_purpose_flag & GeneralPurposeFlags::DATA_DESCRIPTOR;
+    if (header.compression_method == CompressionMethod::NONE)
+    {
+        Lud::check::is_false(data_descriptor, "Stored entries with a data descriptor can not be streamed");
+        remaining = header.compressed_size;
+    }
+    else
+    {
+        inflateReset(&inflater);
+    }
+
+    uncompressed_size = 0;
+    crc = 0;
+    data_finished = false;
+    entry_finished = false;
+
+    return true;
+}
+
+size_t ZipStreamReader::Impl::read_data(std::span<char> output)
+{
+    if (data_finished)
+    {
+        return 0;
+    }
+
+    size_t read = 0;
+    if (header.compression_method == CompressionMethod::NONE)
+    {
+        const auto to_read = static_cast<std::streamsize>(std::min<uint64_t>(remaining, output.size()));
+        read = static_cast<size_t>(source.sgetn(output.data(), to_read));
+        Lud::check::that(read == static_cast<size_t>(to_read), "Unexpected end of zip stream");
+
+        remaining -= read;
+        data_finished = remaining == 0;
+    }
+    else
+    {
+        read = inflate_data(output);
+    }
+
+#ifdef VARF_DO_CRC_32
+    crc = _detail_::crc32({reinterpret_cast<const uint8_t*>(output.data()), read}, crc);
+#endif
+    uncompressed_size += read;
+
+    if (data_finished)
+    {
+        finish_entry();
+    }
+    return read;
+}
+
+size_t ZipStreamReader::Impl::inflate_data(std::span<char> output)
+{
+    inflater.next_out = reinterpret_cast<Bytef*>(output.data());
+    inflater.avail_out = static_cast<uInt>(output.size());
+
+    // stops once something was produced, so data is available as soon as possible
+    while (inflater.avail_out == output.size() && !data_finished)
+    {
+        const auto input = source.Fill(1);
+        Lud::check::that(!input.empty(), "Unexpected end of zip stream");
+
+        inflater.next_in = const_cast<Bytef*>(input.data());
+        inflater.avail_in = static_cast<uInt>(input.size());
+
+        const int result = inflate(&inflater, Z_NO_FLUSH);
+        Lud::check::that(result == Z_OK || result == Z_STREAM_END, "Entry is corrupted and can not be recovered");
+
+        // only what inflate used is consumed, the rest belongs to what comes after the entry
+        source.Consume(input.size() - inflater.avail_in);
+        data_finished = result == Z_STREAM_END;
+    }
+
+    return output.size() - inflater.avail_out;
+}
+
+void ZipStreamReader::Impl::finish_entry()
+{
+    if (entry_finished)
+    {
+        return;
+    }
+    entry_finished = true;
+
+    if (header.gen_purpose_flag & GeneralPurposeFlags::DATA_DESCRIPTOR)
+    {
+        const auto dd = read_data_descriptor(source_stream, header.zip64);
+        Lud::check::that(source_stream.good(), "Unexpected end of zip stream");
+
+        header.CRC_32 = dd.CRC_32;
+        header.uncompressed_size = dd.uncompressed_size;
+    }
+
+    Lud::check::eq(uncompressed_size, header.uncompressed_size, "Entry size does not match its header");
+#ifdef VARF_DO_CRC_32
+    Lud::check::eq(
+        header.CRC_32,
+        crc,
+        std::format("File: [{}] is corrupted and can not be recovered", header.file_name));
+#endif
+}
+
+ZipStreamReader::ZipStreamReader(std::istream& stream)
+    : p_impl(new Impl(stream))
+{
+}
+
+ZipStreamReader::~ZipStreamReader()
+{
+    delete p_impl;
+}
+
+bool ZipStreamReader::Next()
+{
+    return p_impl->next();
+}
+
+std::string_view ZipStreamReader::GetName() const
+{
+    return p_impl->header.file_name;
+}
+
+std::istream& ZipStreamReader::GetStream()
+{
+    return p_impl->entry_stream;
 }
 
 } // namespace varf
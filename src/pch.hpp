@@ -10,8 +10,11 @@
 #include <streambuf>  // IWYU pragma: keep
 
 // data structures
+#include <array>         // IWYU pragma: keep
 #include <deque>         // IWYU pragma: keep
 #include <memory>        // IWYU pragma: keep
+#include <optional>      // IWYU pragma: keep
+#include <span>          // IWYU pragma: keep
 #include <unordered_map> // IWYU pragma: keep
 #include <variant>       // IWYU pragma: keep
 #include <vector>        // IWYU pragma: keep
@@ -20,6 +23,11 @@
 #include <algorithm> // IWYU pragma: keep
 #include <ranges>    // IWYU pragma: keep
 
+// concurrency
+#include <atomic> // IWYU pragma: keep
+#include <mutex>  // IWYU pragma: keep
+#include <thread> // IWYU pragma: keep
+
 // string types
 #include <cstring>     // IWYU pragma: keep
 #include <string>      // IWYU pragma: keep
@@ -32,6 +40,8 @@
 // utility
 #include <bit>          // IWYU pragma: keep
 #include <compare>      // IWYU pragma: keep
+#include <format>       // IWYU pragma: keep
+#include <functional>   // IWYU pragma: keep
 #include <print>        // IWYU pragma: keep
 #include <stdexcept>    // IWYU pragma: keep
 #include <system_error> // IWYU pragma: keep
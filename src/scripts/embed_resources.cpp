@@ -56,13 +56,24 @@ int main(int argc, char** argv)
     const auto output_file = argc > 2 ? argv[2] : "generated_resources.cpp";
     const auto var_name = argc > 3 ? argv[3] : "RESOURCES_BINDUMP";
 
-    varf::RezipArchive archive;
-    for (const auto& file : traverse(resources_path))
+    const auto files = traverse(resources_path);
+
+    std::vector<std::string> names;
+    std::vector<std::ifstream> streams;
+    std::vector<varf::ArchiveInput> inputs;
+    names.reserve(files.size());
+    streams.reserve(files.size());
+    inputs.reserve(files.size());
+    for (const auto& file : files)
     {
-        std::ifstream stream(file, std::ios::binary);
-        archive.Push(file.string(), stream);
+        auto& name = names.emplace_back(file.string());
+        auto& stream = streams.emplace_back(file, std::ios::binary);
+        inputs.emplace_back(name, &stream);
     }
 
+    varf::RezipArchive archive;
+    archive.PushMany(inputs);
+
     std::vector<uint8_t> data;
     Lud::vector_ostream vec_stream(data);
     archive.Write(vec_stream);
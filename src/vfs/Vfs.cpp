@@ -43,9 +43,9 @@ size_t VTree::Load(const fs::path& path)
     return elems;
 }
 
-size_t VTree::LoadArchive(const Archive& archive)
+size_t VTree::LoadArchive(std::shared_ptr<const Archive> archive)
 {
-    auto directory = archive.GetDirectory();
+    auto directory = archive->GetDirectory();
     size_t elems = 0;
 
     for (const auto& entry : directory)
@@ -57,7 +57,7 @@ size_t VTree::LoadArchive(const Archive& archive)
         }
         else
         {
-            elems += VTree::Add(entry.file_name, archive.Peek(entry));
+            elems += add_file(entry.file_name, VFile(archive, entry));
         }
     }
     return elems;
@@ -88,6 +88,11 @@ bool VTree::Add(const std::string_view path)
 }
 
 bool VTree::Add(const std::string_view path, std::vector<uint8_t>&& data)
+{
+    return add_file(path, VFile(std::move(data)));
+}
+
+bool VTree::add_file(const std::string_view path, VFile&& file)
 {
     if (path.empty())
     {
@@ -107,7 +112,7 @@ bool VTree::Add(const std::string_view path, std::vector<uint8_t>&& data)
     {
         return false;
     }
-    last->children.emplace(parts.back(), std::move(data));
+    last->children.emplace(parts.back(), std::move(file));
     return true;
 }
 
@@ -217,7 +222,7 @@ std::shared_ptr<std::istream> VTree::Get(const std::string_view path)
     {
         return nullptr;
     }
-    return std::make_shared<Lud::memory_istream<uint8_t>>(vfile->data);
+    return std::make_shared<Lud::memory_istream<uint8_t>>(vfile->GetData());
 }
 
 VTree::VFile::VFile(std::vector<uint8_t>&& vec_data)
@@ -225,4 +230,26 @@ VTree::VFile::VFile(std::vector<uint8_t>&& vec_data)
 {
 }
 
+VTree::VFile::VFile(std::shared_ptr<const Archive> file_archive, const ArchiveEntry& file_entry)
+    : archive(std::move(file_archive))
+    , entry(file_entry)
+{
+}
+
+std::span<const uint8_t> VTree::VFile::GetData()
+{
+    if (archive)
+    {
+        data = archive->Peek(*entry);
+        archive.reset();
+        entry.reset();
+    }
+    return data;
+}
+
+size_t VTree::VFile::GetSize() const
+{
+    return entry ? entry->uncompressed_size : data.size();
+}
+
 } // namespace varf
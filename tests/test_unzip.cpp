@@ -1,6 +1,10 @@
 #include "FileManager/archive/zip.hpp"
+#include "FileManager/archive/rezip.hpp"
 #include <catch2/catch_all.hpp>
 #include <ludutils/lud_mem_stream.hpp>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
 
 #ifdef _WIN32
     #define EXTERNAL_LINKAGE extern
@@ -46,3 +50,1068 @@ TEST_CASE("Unzip memory", "[vfs][unzip]")
         REQUIRE_NOTHROW(requires_block());
     }
 }
+
+TEST_CASE("Unzip memory lazily", "[vfs][unzip]")
+{
+    Lud::memory_istream<uint8_t> stream({TEST_ZIP, TEST_ZIP_len});
+    varf::ZipArchive archive(stream, varf::archive_mode::lazy);
+    auto files = archive.GetDirectory();
+
+    SECTION("Correct folder structure")
+    {
+        REQUIRE(files.size() == 6);
+        REQUIRE(files[2].file_name == "test/A/B.txt");
+        REQUIRE(files[5].file_name == "test/C.txt");
+    }
+
+    SECTION("File with content")
+    {
+        auto this_is_a_text = archive.Peek(files[2]) | std::ranges::to<std::string>();
+        auto this_is_a_test = archive.Pop(files[5]) | std::ranges::to<std::string>();
+        REQUIRE(this_is_a_test == "this is a test");
+        REQUIRE(this_is_a_text == "this is a text");
+        REQUIRE(archive.GetDirectory().size() == 5);
+    }
+}
+
+TEST_CASE("Unzip streaming", "[vfs][unzip]")
+{
+    Lud::memory_istream<uint8_t> stream({TEST_ZIP, TEST_ZIP_len});
+    varf::ZipArchive archive(stream, varf::archive_mode::lazy);
+    auto files = archive.GetDirectory();
+
+    auto entry_stream = archive.Open(files[5]);
+    std::string content(std::istreambuf_iterator<char>(*entry_stream), {});
+    REQUIRE(content == "this is a test");
+
+    auto empty_stream = archive.Open(files[4]);
+    REQUIRE(empty_stream->get() == std::char_traits<char>::eof());
+}
+
+TEST_CASE("Zip push many", "[vfs][unzip]")
+{
+    const std::string text = "this is a text";
+    const std::span<const uint8_t> text_data(reinterpret_cast<const uint8_t*>(text.data()), text.size());
+
+    std::vector<varf::ArchiveInput> inputs;
+    for (size_t i = 0; i < 64; i++)
+    {
+        inputs.emplace_back(i % 2 ? "odd" : "even", text_data);
+    }
+
+    varf::ZipArchive single_thread;
+    single_thread.PushMany(inputs, 1);
+    varf::ZipArchive multi_thread;
+    multi_thread.PushMany(inputs, 8);
+
+    std::vector<uint8_t> single_data;
+    std::vector<uint8_t> multi_data;
+    {
+        Lud::vector_ostream single_stream(single_data);
+        single_thread.Write(single_stream);
+        Lud::vector_ostream multi_stream(multi_data);
+        multi_thread.Write(multi_stream);
+    }
+    REQUIRE(single_data == multi_data);
+
+    auto files = multi_thread.GetDirectory();
+    REQUIRE(files.size() == 64);
+    REQUIRE(files[1].file_name == "odd");
+    REQUIRE((multi_thread.Peek(files[63]) | std::ranges::to<std::string>()) == text);
+}
+
+TEST_CASE("Zip writer", "[vfs][unzip]")
+{
+    const std::string text = "this is a text";
+
+    std::vector<uint8_t> zip_data;
+    {
+        Lud::vector_ostream output(zip_data);
+        varf::ZipWriter writer(output);
+
+        Lud::memory_istream<uint8_t> text_stream({reinterpret_cast<const uint8_t*>(text.data()), text.size()});
+        writer.Push("test/A/B.txt", text_stream);
+        writer.Push("test/empty.txt", std::span<const uint8_t>{});
+        writer.Finish();
+    }
+
+    Lud::memory_istream<uint8_t> stream(zip_data);
+    varf::ZipArchive archive(stream);
+    auto files = archive.GetDirectory();
+
+    REQUIRE(files.size() == 2);
+    REQUIRE(files[0].file_name == "test/A/B.txt");
+    REQUIRE((archive.Peek(files[0]) | std::ranges::to<std::string>()) == text);
+    REQUIRE(archive.Peek(files[1]).empty());
+}
+
+// fails every read after the first window of data
+class FailingStreambuf : public std::streambuf
+{
+public:
+    int_type underflow() override
+    {
+        if (m_read)
+        {
+            throw std::runtime_error("read error");
+        }
+        m_read = true;
+        setg(m_data.data(), m_data.data(), m_data.data() + m_data.size());
+        return traits_type::to_int_type(m_data.front());
+    }
+
+private:
+    std::string m_data = std::string(1024, 'x');
+    bool m_read = false;
+};
+
+TEST_CASE("Zip writer failing input", "[vfs][unzip]")
+{
+    std::vector<uint8_t> zip_data;
+    Lud::vector_ostream output(zip_data);
+    varf::ZipWriter writer(output);
+
+    FailingStreambuf failing;
+    std::istream input(&failing);
+    REQUIRE_THROWS(writer.Push("failing.txt", input));
+}
+
+TEST_CASE("Zip64 entry count", "[vfs][unzip]")
+{
+    // more entries than fit in the 16 bit EOCD counters
+    constexpr size_t entry_count = 0x10000 + 10;
+
+    std::vector<std::string> names;
+    std::vector<varf::ArchiveInput> inputs;
+    names.reserve(entry_count);
+    for (size_t i = 0; i < entry_count; i++)
+    {
+        inputs.emplace_back(names.emplace_back(std::to_string(i)), std::span<const uint8_t>{});
+    }
+
+    varf::ZipArchive archive;
+    archive.PushMany(inputs);
+
+    std::vector<uint8_t> zip_data;
+    {
+        Lud::vector_ostream output(zip_data);
+        archive.Write(output);
+    }
+
+    Lud::memory_istream<uint8_t> stream(zip_data);
+    varf::ZipArchive read_archive(stream, varf::archive_mode::lazy);
+    auto files = read_archive.GetDirectory();
+
+    REQUIRE(files.size() == entry_count);
+    REQUIRE(files.back().file_name == std::to_string(entry_count - 1));
+}
+
+#ifdef VARF_DO_CRC_32
+TEST_CASE("Zip crc", "[vfs][unzip]")
+{
+    // short enough to be stored, so the text can be found in the zip
+    const std::string text = "data";
+
+    varf::ZipArchive archive;
+    Lud::memory_istream<uint8_t> text_stream({reinterpret_cast<const uint8_t*>(text.data()), text.size()});
+    archive.Push("file.txt", text_stream);
+
+    std::vector<uint8_t> zip_data;
+    {
+        Lud::vector_ostream output(zip_data);
+        archive.Write(output);
+    }
+
+    SECTION("Correct crc")
+    {
+        Lud::memory_istream<uint8_t> stream(zip_data);
+        varf::ZipArchive read_archive(stream);
+        auto files = read_archive.GetDirectory();
+        REQUIRE((read_archive.Peek(files[0]) | std::ranges::to<std::string>()) == text);
+    }
+
+    SECTION("Corrupted data")
+    {
+        auto data = std::ranges::search(zip_data, text);
+        REQUIRE_FALSE(data.empty());
+        data.front() = 'D';
+
+        Lud::memory_istream<uint8_t> stream(zip_data);
+        varf::ZipArchive read_archive(stream);
+        auto files = read_archive.GetDirectory();
+        REQUIRE_THROWS(read_archive.Peek(files[0]));
+
+        auto entry_stream = read_archive.Open(files[0]);
+        std::string read(text.size() + 1, '\0');
+        entry_stream->read(read.data(), static_cast<std::streamsize>(read.size()));
+        REQUIRE(entry_stream->bad());
+    }
+}
+#endif
+
+TEST_CASE("Unzip with comment", "[vfs][unzip]")
+{
+    std::vector<uint8_t> zip_data(TEST_ZIP, TEST_ZIP + TEST_ZIP_len);
+
+    // a comment containing something that looks like an EOCD, it does not end at EOF
+    const std::array<uint8_t, 26> comment{0x50, 0x4B, 0x05, 0x06};
+    const auto comment_length = static_cast<uint16_t>(comment.size());
+    std::memcpy(zip_data.data() + zip_data.size() - 2, &comment_length, sizeof(comment_length));
+    zip_data.insert(zip_data.end(), comment.begin(), comment.end());
+
+    Lud::memory_istream<uint8_t> stream(zip_data);
+    varf::ZipArchive archive(stream);
+    auto files = archive.GetDirectory();
+
+    REQUIRE(files.size() == 6);
+    REQUIRE((archive.Peek(files[5]) | std::ranges::to<std::string>()) == "this is a test");
+}
+
+TEST_CASE("Zip empty archive", "[vfs][unzip]")
+{
+    varf::ZipArchive archive;
+
+    std::vector<uint8_t> zip_data;
+    {
+        Lud::vector_ostream output(zip_data);
+        archive.Write(output);
+    }
+
+    Lud::memory_istream<uint8_t> stream(zip_data);
+    varf::ZipArchive read_archive(stream);
+
+    REQUIRE(read_archive.GetDirectory().empty());
+}
+
+TEST_CASE("Unzip find", "[vfs][unzip]")
+{
+    Lud::memory_istream<uint8_t> stream({TEST_ZIP, TEST_ZIP_len});
+    varf::ZipArchive archive(stream);
+
+    auto text = archive.Find("test/C.txt");
+    REQUIRE(text.has_value());
+    REQUIRE(text->file_name == "test/C.txt");
+    REQUIRE((archive.Peek(*text) | std::ranges::to<std::string>()) == "this is a test");
+
+    REQUIRE_FALSE(archive.Find("test/D.txt").has_value());
+
+    archive.Pop(*archive.Find("test/A/"));
+    REQUIRE_FALSE(archive.Find("test/A/").has_value());
+    REQUIRE((archive.Peek(*archive.Find("test/C.txt")) | std::ranges::to<std::string>()) == "this is a test");
+}
+
+TEST_CASE("Unzip stable handles", "[vfs][unzip]")
+{
+    Lud::memory_istream<uint8_t> stream({TEST_ZIP, TEST_ZIP_len});
+    varf::ZipArchive archive(stream);
+    auto files = archive.GetDirectory();
+
+    // popping an entry does not invalidate the handles of the others
+    REQUIRE(archive.Pop(files[2]).size() == 14);
+    REQUIRE((archive.Peek(files[5]) | std::ranges::to<std::string>()) == "this is a test");
+    REQUIRE(archive.GetDirectory().size() == files.size() - 1);
+
+    // a popped handle is not valid anymore, and new entries go after the existing ones
+    REQUIRE_THROWS(archive.Peek(files[2]));
+    Lud::memory_istream<uint8_t> empty_stream(std::span<const uint8_t>{});
+    archive.Push("new.txt", empty_stream);
+    REQUIRE_THROWS(archive.Pop(files[2]));
+    REQUIRE(archive.GetDirectory().back().file_name == "new.txt");
+
+    for (const auto& file : files)
+    {
+        if (file.index != files[2].index)
+        {
+            archive.Pop(file);
+        }
+    }
+    REQUIRE(archive.GetDirectory().size() == 1);
+    REQUIRE(archive.GetDirectory().front().file_name == "new.txt");
+}
+
+static void push_text(varf::Archive& archive, const std::string_view name, const std::string& text)
+{
+    std::istringstream data(text);
+    archive.Push(name, data);
+}
+
+// the name index views the names of the entries, it must not keep views of removed ones
+static void check_find_after_pop(varf::Archive& archive)
+{
+    // a short name reused by a longer one in the same slot
+    push_text(archive, "a", "first");
+    archive.Pop(*archive.Find("a"));
+    push_text(archive, "ab", "second");
+    REQUIRE_FALSE(archive.Find("a").has_value());
+    REQUIRE((archive.Peek(*archive.Find("ab")) | std::ranges::to<std::string>()) == "second");
+
+    // two entries with the same long name, the older one is popped
+    const std::string name(64, 'n');
+    push_text(archive, name, "old");
+    const auto old_entry = *archive.Find(name);
+    push_text(archive, name, "new");
+    archive.Pop(old_entry);
+    REQUIRE((archive.Peek(*archive.Find(name)) | std::ranges::to<std::string>()) == "new");
+    archive.Pop(*archive.Find(name));
+    REQUIRE_FALSE(archive.Find(name).has_value());
+
+    // popping the newest of two entries with the same name finds the older one again
+    push_text(archive, "c", "older");
+    push_text(archive, "c", "newer");
+    archive.Pop(*archive.Find("c"));
+    REQUIRE((archive.Peek(*archive.Find("c")) | std::ranges::to<std::string>()) == "older");
+
+    // entries keep the order they were added in, whatever was popped before
+    push_text(archive, "d", "last");
+    const auto directory = archive.GetDirectory();
+    REQUIRE(directory.back().file_name == "d");
+    REQUIRE(directory.front().file_name == "ab");
+}
+
+TEST_CASE("Unzip find after pop", "[vfs][unzip]")
+{
+    varf::ZipArchive archive;
+    check_find_after_pop(archive);
+}
+
+TEST_CASE("Rezip find after pop", "[vfs][unzip]")
+{
+    varf::RezipArchive archive;
+    check_find_after_pop(archive);
+}
+
+TEST_CASE("Zip raw copy", "[vfs][unzip]")
+{
+    Lud::memory_istream<uint8_t> stream({TEST_ZIP, TEST_ZIP_len});
+    varf::ZipArchive source(stream, varf::archive_mode::lazy);
+
+    varf::ZipArchive archive;
+    for (const auto& file : source.GetDirectory())
+    {
+        archive.CopyEntryFrom(source, file);
+    }
+
+    std::vector<uint8_t> zip_data;
+    {
+        Lud::vector_ostream output(zip_data);
+        archive.Write(output);
+    }
+
+    Lud::memory_istream<uint8_t> copy_stream(zip_data);
+    varf::ZipArchive copy(copy_stream);
+
+    REQUIRE(copy.GetDirectory().size() == source.GetDirectory().size());
+    REQUIRE((copy.Peek(*copy.Find("test/A/B.txt")) | std::ranges::to<std::string>()) == "this is a text");
+    REQUIRE(copy.PeekRaw(*copy.Find("test/C.txt")).compressed_data == source.PeekRaw(*source.Find("test/C.txt")).compressed_data);
+}
+
+TEST_CASE("Zip update in place", "[vfs][unzip]")
+{
+    std::stringstream stream(std::ios::in | std::ios::out | std::ios::binary);
+    stream.write(reinterpret_cast<const char*>(TEST_ZIP), TEST_ZIP_len);
+
+    const std::string text = "this is a new text";
+    {
+        varf::ZipArchive archive(stream, varf::archive_mode::update);
+        std::istringstream text_stream(text);
+        archive.Push("test/D.txt", text_stream);
+        REQUIRE(archive.Commit() == stream.str().size());
+
+        // committed entries are read from the stream afterwards
+        REQUIRE((archive.Peek(*archive.Find("test/D.txt")) | std::ranges::to<std::string>()) == text);
+    }
+
+    const auto data = stream.str();
+    // the original archive is kept as it was, the changes are appended
+    REQUIRE(std::memcmp(TEST_ZIP, data.data(), TEST_ZIP_len) == 0);
+
+    varf::ZipArchive archive(stream);
+    REQUIRE(archive.GetDirectory().size() == 7);
+    REQUIRE((archive.Peek(*archive.Find("test/D.txt")) | std::ranges::to<std::string>()) == text);
+    REQUIRE((archive.Peek(*archive.Find("test/C.txt")) | std::ranges::to<std::string>()) == "this is a test");
+}
+
+// writes to a file until a number of bytes was written, then fails like a full disk would
+class FailingFilebuf : public std::filebuf
+{
+public:
+    void SetLimit(std::streamsize limit)
+    {
+        m_limit = limit;
+    }
+
+protected:
+    std::streamsize xsputn(const char* data, std::streamsize size) override
+    {
+        const auto written = std::filebuf::xsputn(data, std::min(size, m_limit));
+        m_limit -= written;
+        return written;
+    }
+
+    int_type overflow(int_type c) override
+    {
+        if (traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            return std::filebuf::overflow(c);
+        }
+        if (m_limit <= 0)
+        {
+            return traits_type::eof();
+        }
+        m_limit--;
+        return std::filebuf::overflow(c);
+    }
+
+private:
+    std::streamsize m_limit{std::numeric_limits<std::streamsize>::max()};
+};
+
+TEST_CASE("Zip failed commit", "[vfs][unzip]")
+{
+    const auto path = std::filesystem::temp_directory_path() / "varf_failed_commit.zip";
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(TEST_ZIP), TEST_ZIP_len);
+    }
+
+    const std::string text(0x1000, 't');
+    {
+        FailingFilebuf buffer;
+        // unbuffered, so every write reaches the limit check
+        buffer.pubsetbuf(nullptr, 0);
+        REQUIRE(buffer.open(path, std::ios::in | std::ios::out | std::ios::binary));
+        std::iostream stream(&buffer);
+
+        varf::ZipArchive archive(stream, varf::archive_mode::update);
+        archive.SetCompressionPolicy({.compression = varf::archive_compression::none});
+        std::istringstream text_stream(text);
+        archive.Push("test/D.txt", text_stream);
+
+        // the entry is cut off halfway
+        buffer.SetLimit(0x800);
+        REQUIRE_THROWS(archive.Commit());
+
+        // the new entry was not written, so it is still held in memory
+        REQUIRE((archive.Peek(*archive.Find("test/D.txt")) | std::ranges::to<std::string>()) == text);
+    }
+
+    // the previous archive was not overwritten, dropping what was appended recovers it
+    REQUIRE(std::filesystem::file_size(path) > TEST_ZIP_len);
+    std::filesystem::resize_file(path, TEST_ZIP_len);
+
+    std::ifstream file(path, std::ios::binary);
+    const std::string data(std::istreambuf_iterator<char>(file), {});
+    REQUIRE(std::memcmp(TEST_ZIP, data.data(), TEST_ZIP_len) == 0);
+
+    Lud::memory_istream<uint8_t> stream(std::span(reinterpret_cast<const uint8_t*>(data.data()), data.size()));
+    varf::ZipArchive archive(stream);
+    REQUIRE(archive.GetDirectory().size() == 6);
+    REQUIRE_FALSE(archive.Find("test/D.txt").has_value());
+    REQUIRE((archive.Peek(*archive.Find("test/C.txt")) | std::ranges::to<std::string>()) == "this is a test");
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Zip compression policy", "[vfs][unzip]")
+{
+    const std::string text(0x1000, 'a');
+    std::vector<uint8_t> noise(0x4000);
+    uint32_t state = 1;
+    for (auto& byte : noise)
+    {
+        state = state * 1664525 + 1013904223;
+        byte = static_cast<uint8_t>(state >> 24);
+    }
+
+    varf::ZipArchive archive;
+    const auto push = [&](std::string_view name, std::span<const uint8_t> data) {
+        Lud::memory_istream<uint8_t> stream(data);
+        archive.Push(name, stream);
+        return *archive.Find(name);
+    };
+    const std::span<const uint8_t> text_data{reinterpret_cast<const uint8_t*>(text.data()), text.size()};
+
+    REQUIRE(push("text.txt", text_data).compressed_size < text.size());
+    REQUIRE(push("text.PNG", text_data).compressed_size == text.size());
+    REQUIRE(archive.PeekRaw(push("noise.bin", noise)).compression == varf::archive_compression::none);
+
+    archive.SetCompressionPolicy({.compression = varf::archive_compression::none});
+    REQUIRE(push("stored.txt", text_data).compressed_size == text.size());
+
+    archive.SetCompressionPolicy({.deflated_extensions = {".png"}});
+    REQUIRE(push("deflated.png", text_data).compressed_size < text.size());
+
+    REQUIRE((archive.Peek(*archive.Find("text.PNG")) | std::ranges::to<std::string>()) == text);
+    REQUIRE((archive.Peek(*archive.Find("deflated.png")) | std::ranges::to<std::string>()) == text);
+}
+
+TEST_CASE("Unzip forward only", "[vfs][unzip]")
+{
+    SECTION("Zip file")
+    {
+        Lud::memory_istream<uint8_t> stream({TEST_ZIP, TEST_ZIP_len});
+        varf::ZipStreamReader reader(stream);
+
+        std::vector<std::string> names;
+        while (reader.Next())
+        {
+            names.emplace_back(reader.GetName());
+            if (reader.GetName() == "test/C.txt")
+            {
+                std::string text(std::istreambuf_iterator<char>(reader.GetStream()), {});
+                REQUIRE(text == "this is a test");
+            }
+        }
+        REQUIRE(names.size() == 6);
+        REQUIRE(names[2] == "test/A/B.txt");
+    }
+
+    SECTION("Entries with data descriptors")
+    {
+        const std::string text(0x10000, 'a');
+
+        std::vector<uint8_t> zip_data;
+        {
+            Lud::vector_ostream output(zip_data);
+            varf::ZipWriter writer(output);
+            writer.Push("first.txt", std::span{reinterpret_cast<const uint8_t*>(text.data()), text.size()});
+            writer.Push("second.txt", std::span{reinterpret_cast<const uint8_t*>(text.data()), 10});
+        }
+
+        Lud::memory_istream<uint8_t> stream(zip_data);
+        varf::ZipStreamReader reader(stream);
+
+        // the first entry is skipped without being read
+        REQUIRE(reader.Next());
+        REQUIRE(reader.Next());
+        REQUIRE(reader.GetName() == "second.txt");
+        std::string second(std::istreambuf_iterator<char>(reader.GetStream()), {});
+        REQUIRE(second == text.substr(0, 10));
+        REQUIRE_FALSE(reader.Next());
+    }
+}
+
+TEST_CASE("Unzip extract all", "[vfs][unzip]")
+{
+    const auto destination = std::filesystem::temp_directory_path() / "varf_extract_all";
+    std::filesystem::remove_all(destination);
+
+    SECTION("Zip file")
+    {
+        Lud::memory_istream<uint8_t> stream({TEST_ZIP, TEST_ZIP_len});
+        varf::ZipArchive archive(stream);
+
+        const auto stats = archive.ExtractAll(destination, {.threads = 4});
+        REQUIRE(stats.files == 3);
+        REQUIRE(std::filesystem::is_directory(destination / "test/A/A"));
+        REQUIRE(std::filesystem::file_size(destination / "test/B/empty.txt") == 0);
+
+        std::ifstream file(destination / "test/C.txt");
+        std::string text(std::istreambuf_iterator<char>(file), {});
+        REQUIRE(text == "this is a test");
+
+        // existing files are kept when not overwriting
+        REQUIRE(archive.ExtractAll(destination, {.overwrite = false}).skipped == 3);
+    }
+
+    SECTION("Names escaping the destination")
+    {
+        varf::ZipArchive archive;
+        std::istringstream data("data");
+        archive.Push("../escaped.txt", data);
+
+        REQUIRE_THROWS(archive.ExtractAll(destination));
+        REQUIRE_FALSE(std::filesystem::exists(destination.parent_path() / "escaped.txt"));
+    }
+
+    std::filesystem::remove_all(destination);
+}
+
+TEST_CASE("Unzip into buffer", "[vfs][unzip]")
+{
+    Lud::memory_istream<uint8_t> stream({TEST_ZIP, TEST_ZIP_len});
+    varf::ZipArchive archive(stream, varf::archive_mode::lazy);
+    const auto file = *archive.Find("test/C.txt");
+
+    SECTION("Span")
+    {
+        std::array<uint8_t, 32> output{};
+        const auto data = archive.Peek(file, std::span<uint8_t>(output));
+        REQUIRE(data.data() == output.data());
+        REQUIRE((data | std::ranges::to<std::string>()) == "this is a test");
+
+        std::array<uint8_t, 4> small{};
+        REQUIRE_THROWS(archive.Peek(file, std::span<uint8_t>(small)));
+    }
+
+    SECTION("Reused buffer")
+    {
+        std::vector<uint8_t> buffer(64);
+        const auto data = archive.Peek(file, buffer);
+        REQUIRE(buffer.size() == 64);
+        REQUIRE((data | std::ranges::to<std::string>()) == "this is a test");
+
+        REQUIRE(archive.Peek(*archive.Find("test/B/empty.txt"), buffer).empty());
+    }
+}
+
+TEST_CASE("Unzip view", "[vfs][unzip]")
+{
+    const std::string text = "stored data that is viewed in place";
+    varf::ZipArchive archive;
+    archive.SetCompressionPolicy({.compression = varf::archive_compression::none});
+    std::istringstream data(text);
+    archive.Push("stored.txt", data);
+    const auto file = *archive.Find("stored.txt");
+
+    std::vector<uint8_t> scratch;
+    const auto view = archive.View(file, scratch);
+    REQUIRE(scratch.empty());
+    REQUIRE((view | std::ranges::to<std::string>()) == text);
+    // the same bytes the archive holds
+    REQUIRE(view.data() == archive.View(file, scratch).data());
+
+    SECTION("Lazy archives read into scratch")
+    {
+        std::vector<uint8_t> zip_data;
+        Lud::vector_ostream output(zip_data);
+        archive.Write(output);
+
+        Lud::memory_istream<uint8_t> stream(zip_data);
+        varf::ZipArchive lazy(stream, varf::archive_mode::lazy);
+        const auto lazy_view = lazy.View(*lazy.Find("stored.txt"), scratch);
+        REQUIRE(lazy_view.data() == scratch.data());
+        REQUIRE((lazy_view | std::ranges::to<std::string>()) == text);
+    }
+}
+
+// overwrites the 32 bit value at every header with the signature, skipping it
+static void patch_headers(std::vector<uint8_t>& data, uint32_t signature, size_t offset, uint32_t value)
+{
+    for (size_t i = 0; i + offset + sizeof(value) <= data.size(); i++)
+    {
+        if (std::memcmp(data.data() + i, &signature, sizeof(signature)) == 0)
+        {
+            std::memcpy(data.data() + i + offset, &value, sizeof(value));
+        }
+    }
+}
+
+TEST_CASE("Unzip stored size mismatch", "[vfs][unzip]")
+{
+    // a stored entry claiming more data than it holds
+    constexpr uint32_t uncompressed_size = 0x10000;
+
+    SECTION("Zip")
+    {
+        varf::ZipArchive archive;
+        archive.SetCompressionPolicy({.compression = varf::archive_compression::none});
+        std::istringstream data("stored");
+        archive.Push("stored.txt", data);
+
+        std::vector<uint8_t> zip_data;
+        Lud::vector_ostream output(zip_data);
+        archive.Write(output);
+        patch_headers(zip_data, 0x04034B50, 22, uncompressed_size);
+        patch_headers(zip_data, 0x02014B50, 24, uncompressed_size);
+
+        Lud::memory_istream<uint8_t> stream(zip_data);
+        REQUIRE_THROWS(varf::ZipArchive{stream});
+        stream.clear();
+        stream.seekg(0);
+        REQUIRE_THROWS(varf::ZipArchive{stream, varf::archive_mode::lazy});
+    }
+
+    SECTION("Rezip")
+    {
+        varf::RezipArchive archive;
+        archive.SetCompressionPolicy({.compression = varf::archive_compression::none});
+        std::istringstream data("stored");
+        archive.Push("stored.txt", data);
+
+        std::vector<uint8_t> rezip_data;
+        Lud::vector_ostream output(rezip_data);
+        archive.Write(output);
+        patch_headers(rezip_data, 0x0405564C, 16, uncompressed_size);
+
+        Lud::memory_istream<uint8_t> stream(rezip_data);
+        REQUIRE_THROWS(varf::RezipArchive{stream});
+        REQUIRE_THROWS(varf::RezipArchive{std::span<const uint8_t>{rezip_data}});
+    }
+}
+
+TEST_CASE("Unzip mapped file", "[vfs][unzip]")
+{
+    const auto path = std::filesystem::temp_directory_path() / "varf_mapped.zip";
+    {
+        std::ofstream file(path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(TEST_ZIP), TEST_ZIP_len);
+    }
+
+    {
+        varf::ZipArchive archive(path);
+        auto files = archive.GetDirectory();
+        REQUIRE(files.size() == 6);
+
+        const auto file = *archive.Find("test/C.txt");
+        REQUIRE((archive.Peek(file) | std::ranges::to<std::string>()) == "this is a test");
+
+        auto stream = archive.Open(file);
+        std::string text(std::istreambuf_iterator<char>(*stream), {});
+        REQUIRE(text == "this is a test");
+    }
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Rezip chunked entries", "[vfs][unzip]")
+{
+    std::string text;
+    for (int i = 0; i < 0x4000; i++)
+    {
+        text += std::to_string(i) + ' ';
+    }
+
+    varf::RezipArchive archive;
+    archive.SetChunkSize(0x1000);
+    std::istringstream data(text);
+    archive.Push("chunked.txt", data);
+
+    std::vector<uint8_t> rezip_data;
+    Lud::vector_ostream output(rezip_data);
+    archive.Write(output);
+    Lud::memory_istream<uint8_t> stream(rezip_data);
+    varf::RezipArchive read_archive(stream);
+    const auto file = *read_archive.Find("chunked.txt");
+
+    REQUIRE((read_archive.Peek(file) | std::ranges::to<std::string>()) == text);
+
+    SECTION("Range across chunks")
+    {
+        std::array<uint8_t, 0x2100> range{};
+        const auto data = read_archive.PeekRange(file, 0xF00, range);
+        REQUIRE((data | std::ranges::to<std::string>()) == text.substr(0xF00, range.size()));
+
+        const auto tail = read_archive.PeekRange(file, text.size() - 10, range);
+        REQUIRE((tail | std::ranges::to<std::string>()) == text.substr(text.size() - 10));
+    }
+
+    SECTION("Chunks form a single deflate stream")
+    {
+        varf::ZipArchive zip;
+        zip.CopyEntryFrom(read_archive, file);
+        REQUIRE((zip.Peek(*zip.Find("chunked.txt")) | std::ranges::to<std::string>()) == text);
+    }
+}
+
+TEST_CASE("Rezip deduplication", "[vfs][unzip]")
+{
+    const std::string text(0x1000, 'a');
+    varf::RezipArchive archive;
+    for (const auto* name : {"first.txt", "second.txt", "third.txt"})
+    {
+        std::istringstream data(text);
+        archive.Push(name, data);
+    }
+    std::istringstream other("other");
+    archive.Push("other.txt", other);
+
+    std::vector<uint8_t> rezip_data;
+    Lud::vector_ostream output(rezip_data);
+    varf::RezipArchive::DeduplicationStats stats;
+    archive.Write(output, stats);
+    REQUIRE(stats.deduplicated_entries == 2);
+    REQUIRE(stats.saved_bytes > 0);
+
+    Lud::memory_istream<uint8_t> stream(rezip_data);
+    varf::RezipArchive read_archive(stream);
+    REQUIRE(read_archive.GetDirectory().size() == 4);
+    REQUIRE((read_archive.Peek(*read_archive.Find("third.txt")) | std::ranges::to<std::string>()) == text);
+    REQUIRE((read_archive.Peek(*read_archive.Find("other.txt")) | std::ranges::to<std::string>()) == "other");
+}
+
+TEST_CASE("Rezip dictionary", "[vfs][unzip]")
+{
+    std::vector<std::string> texts;
+    for (int i = 0; i < 32; i++)
+    {
+        texts.push_back(std::format(R"({{"name": "entry {}", "type": "texture", "filter": "linear", "wrap": "repeat", "mipmaps": true}})", i));
+    }
+    const auto samples = texts
+                       | std::views::transform([](const std::string& text) {
+                             return std::span{reinterpret_cast<const uint8_t*>(text.data()), text.size()};
+                         })
+                       | std::ranges::to<std::vector<std::span<const uint8_t>>>();
+
+    varf::RezipArchive archive;
+    archive.SetDictionary(varf::RezipArchive::TrainDictionary(samples));
+    for (size_t i = 0; i < texts.size(); i++)
+    {
+        std::istringstream data(texts[i]);
+        archive.Push(std::to_string(i), data);
+    }
+    const auto file = *archive.Find("7");
+    REQUIRE(file.compressed_size < texts[7].size() / 2);
+
+    std::vector<uint8_t> rezip_data;
+    Lud::vector_ostream output(rezip_data);
+    archive.Write(output);
+    Lud::memory_istream<uint8_t> stream(rezip_data);
+    varf::RezipArchive read_archive(stream);
+
+    const auto read_file = *read_archive.Find("7");
+    REQUIRE((read_archive.Peek(read_file) | std::ranges::to<std::string>()) == texts[7]);
+    auto entry_stream = read_archive.Open(read_file);
+    REQUIRE(std::string(std::istreambuf_iterator<char>(*entry_stream), {}) == texts[7]);
+
+    // copies to archives without the dictionary are compressed again
+    varf::ZipArchive zip;
+    zip.CopyEntryFrom(read_archive, read_file);
+    REQUIRE((zip.Peek(*zip.Find("7")) | std::ranges::to<std::string>()) == texts[7]);
+
+    REQUIRE_THROWS(archive.SetDictionary({}));
+}
+
+TEST_CASE("Rezip solid blocks", "[vfs][unzip]")
+{
+    std::vector<std::string> texts;
+    for (int i = 0; i < 64; i++)
+    {
+        texts.push_back(std::format(R"({{"name": "entry {}", "type": "texture", "filter": "linear", "wrap": "repeat", "mipmaps": true}})", i));
+    }
+
+    varf::RezipArchive archive;
+    for (size_t i = 0; i < texts.size(); i++)
+    {
+        std::istringstream data(texts[i]);
+        archive.Push(std::to_string(i), data);
+    }
+
+    std::vector<uint8_t> rezip_data;
+    Lud::vector_ostream output(rezip_data);
+    archive.Write(output);
+
+    // small enough to split the entries in several blocks
+    archive.SetSolidBlockSize(0x800);
+    std::vector<uint8_t> solid_data;
+    Lud::vector_ostream solid_output(solid_data);
+    archive.Write(solid_output);
+    REQUIRE(solid_data.size() < rezip_data.size() / 2);
+
+    Lud::memory_istream<uint8_t> stream(solid_data);
+    varf::RezipArchive read_archive(stream);
+    REQUIRE(read_archive.GetDirectory().size() == texts.size());
+    for (size_t i = 0; i < texts.size(); i++)
+    {
+        REQUIRE((read_archive.Peek(*read_archive.Find(std::to_string(i))) | std::ranges::to<std::string>()) == texts[i]);
+    }
+
+    const auto read_file = *read_archive.Find("42");
+    auto entry_stream = read_archive.Open(read_file);
+    REQUIRE(std::string(std::istreambuf_iterator<char>(*entry_stream), {}) == texts[42]);
+
+    varf::ZipArchive zip;
+    zip.CopyEntryFrom(read_archive, read_file);
+    REQUIRE((zip.Peek(*zip.Find("42")) | std::ranges::to<std::string>()) == texts[42]);
+
+    // without solid blocks the entries are written on their own again
+    std::vector<uint8_t> unpacked_data;
+    Lud::vector_ostream unpacked_output(unpacked_data);
+    read_archive.Write(unpacked_output);
+    Lud::memory_istream<uint8_t> unpacked_stream(unpacked_data);
+    varf::RezipArchive unpacked_archive(unpacked_stream);
+    REQUIRE((unpacked_archive.Peek(*unpacked_archive.Find("42")) | std::ranges::to<std::string>()) == texts[42]);
+}
+
+TEST_CASE("Rezip stored alignment", "[vfs][unzip]")
+{
+    varf::RezipArchive archive;
+    archive.SetCompressionPolicy({.compression = varf::archive_compression::none});
+    archive.SetStoredAlignment(4096);
+
+    std::vector<std::string> texts;
+    for (int i = 0; i < 8; i++)
+    {
+        texts.push_back(std::format("stored entry {} {}", i, std::string(static_cast<size_t>(i) * 1000, 'x')));
+        std::istringstream data(texts.back());
+        archive.Push(std::to_string(i), data);
+    }
+
+    std::vector<uint8_t> rezip_data;
+    Lud::vector_ostream output(rezip_data);
+    archive.Write(output);
+
+    const std::string_view file(reinterpret_cast<const char*>(rezip_data.data()), rezip_data.size());
+    for (const auto& text : texts)
+    {
+        const auto position = file.find(text);
+        REQUIRE(position != std::string_view::npos);
+        REQUIRE(position % 4096 == 0);
+    }
+
+    Lud::memory_istream<uint8_t> stream(rezip_data);
+    varf::RezipArchive read_archive(stream);
+    REQUIRE((read_archive.Peek(*read_archive.Find("5")) | std::ranges::to<std::string>()) == texts[5]);
+}
+
+static void check_name_index(varf::RezipArchive& read_archive)
+{
+    const auto file = read_archive.Find("shaders/main.frag");
+    REQUIRE(file.has_value());
+    REQUIRE((read_archive.Peek(*file) | std::ranges::to<std::string>()) == "shaders/main.frag");
+    REQUIRE_FALSE(read_archive.Find("shaders/main").has_value());
+
+    const auto textures = read_archive.FindPrefix("textures/");
+    REQUIRE(textures.size() == 2);
+    REQUIRE(textures[0].file_name == "textures/a.png");
+    REQUIRE(textures[1].file_name == "textures/b.png");
+    REQUIRE(read_archive.FindPrefix("text").size() == 3);
+    REQUIRE(read_archive.FindPrefix("").size() == 5);
+    REQUIRE(read_archive.FindPrefix("z").empty());
+
+    // once modified the names are indexed in memory
+    std::istringstream data("new");
+    read_archive.Push("textures/c.png", data);
+    read_archive.Pop(*read_archive.Find("textures/a.png"));
+    REQUIRE(read_archive.Find("textures/c.png").has_value());
+    REQUIRE_FALSE(read_archive.Find("textures/a.png").has_value());
+    REQUIRE(read_archive.FindPrefix("textures/").size() == 2);
+    REQUIRE(read_archive.GetDirectory().back().file_name == "textures/c.png");
+}
+
+TEST_CASE("Rezip name index", "[vfs][unzip]")
+{
+    varf::RezipArchive archive;
+    archive.SetNameIndex(true);
+    for (const auto* name : {"textures/b.png", "shaders/main.vert", "textures/a.png", "shaders/main.frag", "texts/readme.txt"})
+    {
+        std::istringstream data(name);
+        archive.Push(name, data);
+    }
+
+    std::vector<uint8_t> rezip_data;
+    Lud::vector_ostream output(rezip_data);
+    archive.Write(output);
+
+    SECTION("Eager")
+    {
+        Lud::memory_istream<uint8_t> stream(rezip_data);
+        varf::RezipArchive read_archive(stream);
+        check_name_index(read_archive);
+    }
+
+    SECTION("Lazy")
+    {
+        varf::RezipArchive read_archive{std::span<const uint8_t>(rezip_data)};
+        check_name_index(read_archive);
+    }
+}
+
+TEST_CASE("Rezip name index lazy open", "[vfs][unzip]")
+{
+    varf::RezipArchive archive;
+    archive.SetNameIndex(true);
+    for (const auto* name : {"first.txt", "broken.txt", "last.txt"})
+    {
+        std::istringstream data(std::format("data of {}", name));
+        archive.Push(name, data);
+    }
+
+    std::vector<uint8_t> rezip_data;
+    Lud::vector_ostream output(rezip_data);
+    archive.Write(output);
+
+    // breaks the central directory header of one entry, the signature is 16 bytes before the name
+    const std::string_view file(reinterpret_cast<const char*>(rezip_data.data()), rezip_data.size());
+    const auto name_position = file.rfind("broken.txt");
+    REQUIRE(name_position != std::string_view::npos);
+    std::memset(rezip_data.data() + name_position - 16, 0, 4);
+
+    // reading every header finds it
+    Lud::memory_istream<uint8_t> stream(rezip_data);
+    REQUIRE_THROWS(varf::RezipArchive{stream});
+
+    // with the index only the headers that are used are parsed
+    const varf::RezipArchive read_archive{std::span<const uint8_t>(rezip_data)};
+    REQUIRE((read_archive.Peek(*read_archive.Find("last.txt")) | std::ranges::to<std::string>()) == "data of last.txt");
+    REQUIRE((read_archive.Peek(*read_archive.Find("first.txt")) | std::ranges::to<std::string>()) == "data of first.txt");
+    REQUIRE_THROWS(read_archive.Find("broken.txt"));
+    REQUIRE_THROWS(read_archive.GetDirectory());
+}
+
+TEST_CASE("Rezip lazy", "[vfs][unzip]")
+{
+    std::string text;
+    for (int i = 0; i < 0x4000; i++)
+    {
+        text += std::to_string(i) + ' ';
+    }
+    const std::string stored_text = "stored, not compressed";
+
+    varf::RezipArchive archive;
+    archive.SetChunkSize(0x1000);
+    std::istringstream data(text);
+    archive.Push("chunked.txt", data);
+    archive.SetCompressionPolicy({.compression = varf::archive_compression::none});
+    std::istringstream stored_data(stored_text);
+    archive.Push("stored.txt", stored_data);
+
+    std::vector<uint8_t> rezip_data;
+    Lud::vector_ostream output(rezip_data);
+    archive.Write(output);
+
+    SECTION("From memory")
+    {
+        const varf::RezipArchive read_archive{std::span<const uint8_t>(rezip_data)};
+        const auto file = *read_archive.Find("chunked.txt");
+        REQUIRE((read_archive.Peek(file) | std::ranges::to<std::string>()) == text);
+
+        // stored entries are viewed where they are in memory
+        std::vector<uint8_t> scratch;
+        const auto view = read_archive.View(*read_archive.Find("stored.txt"), scratch);
+        REQUIRE((view | std::ranges::to<std::string>()) == stored_text);
+        REQUIRE(view.data() >= rezip_data.data());
+        REQUIRE(view.data() < rezip_data.data() + rezip_data.size());
+        REQUIRE(scratch.empty());
+    }
+
+    SECTION("From a stream")
+    {
+        Lud::memory_istream<uint8_t> stream(rezip_data);
+        const varf::RezipArchive read_archive(stream, varf::archive_mode::lazy);
+        const auto file = *read_archive.Find("chunked.txt");
+
+        auto entry_stream = read_archive.Open(file);
+        REQUIRE(std::string(std::istreambuf_iterator<char>(*entry_stream), {}) == text);
+
+        std::array<uint8_t, 0x100> range{};
+        REQUIRE((read_archive.PeekRange(file, 0x1F80, range) | std::ranges::to<std::string>()) == text.substr(0x1F80, range.size()));
+        REQUIRE((read_archive.Peek(*read_archive.Find("stored.txt")) | std::ranges::to<std::string>()) == stored_text);
+
+        std::vector<uint8_t> written_data;
+        Lud::vector_ostream written_output(written_data);
+        read_archive.Write(written_output);
+        REQUIRE(written_data == rezip_data);
+    }
+
+    SECTION("From a mapped file")
+    {
+        const auto path = std::filesystem::temp_directory_path() / "varf_mapped.rezip";
+        {
+            std::ofstream file(path, std::ios::binary);
+            file.write(reinterpret_cast<const char*>(rezip_data.data()), static_cast<std::streamsize>(rezip_data.size()));
+        }
+
+        {
+            const varf::RezipArchive read_archive(path);
+            REQUIRE((read_archive.Peek(*read_archive.Find("chunked.txt")) | std::ranges::to<std::string>()) == text);
+
+            std::vector<uint8_t> scratch;
+            const auto view = read_archive.View(*read_archive.Find("stored.txt"), scratch);
+            REQUIRE((view | std::ranges::to<std::string>()) == stored_text);
+            REQUIRE(scratch.empty());
+        }
+
+        std::filesystem::remove(path);
+    }
+}
@@ -1,7 +1,13 @@
 #include "FileManager/FileManager.hpp"
 #include "FileManager/vfs/Vfs.hpp"
+#include "FileManager/archive/rezip.hpp"
 #include <array>
 #include <catch2/catch_all.hpp>
+#include <cstring>
+#include <format>
+#include <ludutils/lud_mem_stream.hpp>
+#include <memory>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -129,3 +135,42 @@ TEST_CASE("VFS - Remove", "[varf][vfs]")
         REQUIRE(vfs.Remove("this"));
     }
 }
+
+TEST_CASE("VFS - Load archive", "[varf][vfs]")
+{
+    const auto make_text = [](std::string_view name) {
+        return std::format("this is {}, this is {}, this is {}", name, name, name);
+    };
+
+    varf::RezipArchive archive;
+    for (const auto* name : {"data/good.txt", "data/broken.txt"})
+    {
+        std::istringstream data(make_text(name));
+        archive.Push(name, data);
+    }
+    std::vector<uint8_t> rezip_data;
+    Lud::vector_ostream output(rezip_data);
+    archive.Write(output);
+
+    // breaks the deflate data of the second entry, right after its 25 bytes local file header
+    constexpr uint32_t local_file_header_signature = 0x0405564C;
+    size_t header = 1;
+    while (header + 29 < rezip_data.size() && std::memcmp(rezip_data.data() + header, &local_file_header_signature, sizeof(uint32_t)) != 0)
+    {
+        header++;
+    }
+    REQUIRE(header + 29 < rezip_data.size());
+    std::memset(rezip_data.data() + header + 25, 0xFF, 4);
+
+    auto vfs = varf::VTree::Create();
+    // nothing is decompressed yet, so the broken file is not noticed
+    REQUIRE(vfs.LoadArchive(std::make_shared<const varf::RezipArchive>(std::span<const uint8_t>(rezip_data))) == 2);
+    REQUIRE(vfs.Contains("data"));
+
+    auto file = vfs.Get("data/good.txt");
+    REQUIRE(file != nullptr);
+    REQUIRE(varf::Slurp<std::string>(*file) == make_text("data/good.txt"));
+    REQUIRE(varf::Slurp<std::string>(*vfs.Get("data/good.txt")) == make_text("data/good.txt"));
+
+    REQUIRE_THROWS(vfs.Get("data/broken.txt"));
+}